@@ -0,0 +1,3 @@
+#include "Bench.h"
+
+volatile uint32_t bench_sink = 0;
@@ -0,0 +1,85 @@
+// Timing helpers of the host benchmarks
+//
+// Times are wall clock microseconds of the host, not HostClock ones.
+// Numbers from a host only compare implementations with each other,
+// an ESP32 at 240 MHz is about 10 to 30 times slower.
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <chrono>
+
+/** Keeps results alive so the compiler cannot drop the benchmarked work */
+extern volatile uint32_t bench_sink;
+
+inline double Bench_now()
+{
+	return std::chrono::duration<double, std::micro>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/** Calls run() until minUs passed, returns the microseconds of one call */
+template <typename F>
+double Bench_time(F run, double minUs = 200000)
+{
+	run(); // warm up caches and allocations
+	size_t runs = 0;
+	double start = Bench_now();
+	double elapsed = 0;
+	while (elapsed < minUs) {
+		// the clock is read once per batch, short runs are not dwarfed by it
+		for (int i = 0; i < 16; i++)
+			run();
+		runs += 16;
+		elapsed = Bench_now() - start;
+	}
+	return elapsed / runs;
+}
+
+/** MB/s of bytes processed in us microseconds, MB is 10^6 bytes */
+inline double Bench_mbps(size_t bytes, double us)
+{
+	return us > 0 ? bytes / us : 0;
+}
+
+/**
+ * BenchLatency
+ * Latency of each run of one case and the bytes it moved
+ */
+class BenchLatency
+{
+public:
+	BenchLatency()
+	{
+		runs = 0;
+		bytes = 0;
+		totalUs = 0;
+		minUs = 0;
+		maxUs = 0;
+	}
+
+	void add(double us, size_t runBytes)
+	{
+		if (runs == 0 || us < minUs)
+			minUs = us;
+		if (us > maxUs)
+			maxUs = us;
+		runs++;
+		bytes += runBytes;
+		totalUs += us;
+	}
+
+	void print(const char *name) const
+	{
+		printf("%-28s %5u runs %9.1f us mean %9.1f min %9.1f max %8.0f bytes %10.0f bytes/s\n",
+			name, (unsigned)runs, runs ? totalUs / runs : 0, minUs, maxUs,
+			runs ? (double)bytes / runs : 0, totalUs > 0 ? bytes * 1e6 / totalUs : 0);
+	}
+
+private:
+	size_t runs;
+	size_t bytes;
+	double totalUs;
+	double minUs;
+	double maxUs;
+};
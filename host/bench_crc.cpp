@@ -0,0 +1,112 @@
+// Crc32 against the bakercp CRC32 library it replaced, which updates the
+// CRC a nibble at a time from a 16 entry table. On a host Crc32 runs its
+// slicing-by-8 kernel, the ESP32 build uses crc32_le from ROM instead.
+// Both must give the same value for every input.
+#include "Crc32.h"
+#include "Bench.h"
+#include <stdio.h>
+#include <random>
+#include <vector>
+
+// The old namespace is a copy of the bakercp CRC32 library:
+//
+// Copyright (c) 2013 Christopher Baker <https://christopherbaker.net>
+// SPDX-License-Identifier: MIT
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+namespace old {
+
+static const uint32_t crc32_table[] = {
+	0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac,
+	0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+	0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c,
+	0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c
+};
+
+class CRC32
+{
+public:
+	CRC32()
+	{
+		reset();
+	}
+
+	void reset()
+	{
+		_state = ~0L;
+	}
+
+	void update(const uint8_t &data)
+	{
+		uint8_t tbl_idx = 0;
+		tbl_idx = _state ^ (data >> (0 * 4));
+		_state = crc32_table[tbl_idx & 0x0f] ^ (_state >> 4);
+		tbl_idx = _state ^ (data >> (1 * 4));
+		_state = crc32_table[tbl_idx & 0x0f] ^ (_state >> 4);
+	}
+
+	uint32_t finalize() const
+	{
+		return ~_state;
+	}
+
+private:
+	uint32_t _state;
+};
+
+}
+
+static uint32_t oldCalculate(const uint8_t *data, size_t length)
+{
+	old::CRC32 crc;
+	for (size_t i = 0; i < length; i++)
+		crc.update(data[i]);
+	return crc.finalize();
+}
+
+int main()
+{
+	std::mt19937 random(1);
+	std::vector<uint8_t> data(1024 * 1024);
+	for (size_t i = 0; i < data.size(); i++)
+		data[i] = random();
+
+	// odd lengths at odd alignments, the kernel has a head and a tail
+	for (size_t length = 0; length < 300; length++) {
+		for (size_t offset = 0; offset < 8; offset++) {
+			if (Crc32::calculate(&data[offset], length) != oldCalculate(&data[offset], length)) {
+				fprintf(stderr, "bench_crc: CRC differs for %u bytes at %u\n", (unsigned)length, (unsigned)offset);
+				return 1;
+			}
+		}
+	}
+
+	const size_t lengths[] = { 4 * 1024, 64 * 1024, 1024 * 1024 };
+	printf("CRC32\n");
+	for (size_t i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++) {
+		size_t length = lengths[i];
+		const uint8_t *p = &data[0];
+		double oldUs = Bench_time([p, length]() { bench_sink += oldCalculate(p, length); });
+		double newUs = Bench_time([p, length]() { bench_sink += Crc32::calculate(p, length); });
+		printf("%7u bytes: bakercp %7.1f MB/s, Crc32 %7.1f MB/s, %5.1fx\n", (unsigned)length,
+			Bench_mbps(length, oldUs), Bench_mbps(length, newUs), oldUs / newUs);
+	}
+	return 0;
+}
@@ -0,0 +1,109 @@
+// Ratio and speed of Lzss.h on the kinds of files the firmware transfers.
+// Every input is compressed in LZSS_BLOCK pieces like readFile does,
+// decompressed in notification sized pieces like a client does, and
+// must come back unchanged.
+#include "Lzss.h"
+#include "Bench.h"
+#include <stdio.h>
+#include <random>
+#include <string>
+#include <vector>
+
+#define BENCH_LZSS_SIZE (256 * 1024)
+// payload of a notification with a 512 byte MTU
+#define BENCH_LZSS_PIECE 509
+
+static LzssEncoder encoder;
+static LzssDecoder decoder;
+
+/** JSON settings like a configuration file, names repeat and values vary */
+static std::vector<uint8_t> configText()
+{
+	static const char *names[] = { "ssidPrim", "ssidSec", "pwPrim", "pwSec", "hostName",
+		"ntpServer", "timeZone", "interval", "threshold", "ledMode", "logLevel", "mqttTopic" };
+	std::mt19937 random(1);
+	std::string text = "[\n";
+	while (text.length() < BENCH_LZSS_SIZE) {
+		char line[128];
+		snprintf(line, sizeof(line), "{\"name\":\"%s%u\",\"type\":\"%s\",\"value\":\"%u\",\"summary\":\"%s setting\"},\n",
+			names[random() % 12], (unsigned)(random() % 16), random() % 2 ? "integer" : "string",
+			(unsigned)(random() % 100000), names[random() % 12]);
+		text += line;
+	}
+	return std::vector<uint8_t>(text.begin(), text.begin() + BENCH_LZSS_SIZE);
+}
+
+/** Lines of a log file with timestamps and counters */
+static std::vector<uint8_t> logText()
+{
+	std::mt19937 random(2);
+	std::string text;
+	for (unsigned time = 0; text.length() < BENCH_LZSS_SIZE; time += random() % 5000) {
+		char line[128];
+		snprintf(line, sizeof(line), "[%8u][I][file] Writing file: /data/log%u.txt, %u bytes free\n",
+			time, (unsigned)(random() % 10), (unsigned)(random() % 49196));
+		text += line;
+	}
+	return std::vector<uint8_t>(text.begin(), text.begin() + BENCH_LZSS_SIZE);
+}
+
+static std::vector<uint8_t> randomData()
+{
+	std::mt19937 random(3);
+	std::vector<uint8_t> data(BENCH_LZSS_SIZE);
+	for (size_t i = 0; i < data.size(); i++)
+		data[i] = random();
+	return data;
+}
+
+static size_t compress(const std::vector<uint8_t> &data, std::vector<uint8_t> &out)
+{
+	encoder.reset();
+	size_t written = 0;
+	for (size_t done = 0; done < data.size(); done += LZSS_BLOCK) {
+		size_t length = data.size() - done < LZSS_BLOCK ? data.size() - done : LZSS_BLOCK;
+		written += encoder.compress(&data[done], length, &out[written]);
+	}
+	return written + encoder.finish(&out[written]);
+}
+
+static void decompress(const std::vector<uint8_t> &in, size_t length, std::vector<uint8_t> &out)
+{
+	decoder.reset();
+	size_t done = 0;
+	for (size_t used = 0; used < length && done < out.size(); ) {
+		size_t piece = length - used < BENCH_LZSS_PIECE ? length - used : BENCH_LZSS_PIECE;
+		size_t consumed;
+		done += decoder.decompress(&in[used], piece, &consumed, &out[done], out.size() - done);
+		used += consumed;
+	}
+}
+
+int main()
+{
+	struct {
+		const char *name;
+		std::vector<uint8_t> data;
+	} inputs[] = {
+		{ "configuration JSON", configText() },
+		{ "log text", logText() },
+		{ "random bytes", randomData() },
+	};
+	printf("LZSS, %u KB inputs\n", BENCH_LZSS_SIZE / 1024);
+	for (size_t i = 0; i < sizeof(inputs) / sizeof(inputs[0]); i++) {
+		const std::vector<uint8_t> &data = inputs[i].data;
+		std::vector<uint8_t> compressed(LZSS_BOUND(data.size()) + data.size() / LZSS_BLOCK * 18);
+		std::vector<uint8_t> restored(data.size());
+		size_t length = compress(data, compressed);
+		decompress(compressed, length, restored);
+		if (restored != data) {
+			fprintf(stderr, "bench_lzss: %s does not round-trip\n", inputs[i].name);
+			return 1;
+		}
+		double compressUs = Bench_time([&]() { bench_sink += compress(data, compressed); });
+		double decompressUs = Bench_time([&]() { decompress(compressed, length, restored); bench_sink += restored[0]; });
+		printf("%-20s %5.1f %% of the size, compress %6.1f MB/s, decompress %6.1f MB/s\n", inputs[i].name,
+			100.0 * length / data.size(), Bench_mbps(data.size(), compressUs), Bench_mbps(data.size(), decompressUs));
+	}
+	return 0;
+}
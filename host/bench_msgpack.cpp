@@ -0,0 +1,82 @@
+// Parsing a write:value request as JSON with JsonPull and as MessagePack
+// with MsgPackPull, both read byte by byte through a callback like
+// BleRequest_receive does. Both must give the same tokens and texts.
+// The replies of both encodings are compared end to end by bench_requests.
+#include "JsonPull.h"
+#include "MsgPack.h"
+#include "Bench.h"
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+typedef struct BenchSource {
+	const uint8_t *data;
+	size_t length;
+	size_t position;
+} BenchSource;
+
+static int readSource(void *context)
+{
+	BenchSource *source = (BenchSource *)context;
+	return source->position < source->length ? source->data[source->position++] : -1;
+}
+
+/** Tokens and texts of a whole request, one string per token */
+template <typename Parser>
+static void parse(const uint8_t *data, size_t length, std::vector<std::string> *tokens)
+{
+	BenchSource source = { data, length, 0 };
+	char text[64];
+	Parser parser(readSource, &source, text, sizeof(text));
+	uint32_t sum = 0;
+	JsonPull::Token token;
+	while ((token = parser.next()) != JsonPull::JSON_END && token != JsonPull::JSON_ERROR) {
+		sum += token + parser.getText()[0];
+		if (tokens != NULL)
+			tokens->push_back(std::to_string(token) + parser.getText());
+	}
+	bench_sink += sum;
+}
+
+int main()
+{
+	const char json[] = "{\"write\":\"value\",\"value\":{\"ssidPrim\":\"MyNetwork\",\"pwPrim\":\"secret123\","
+		"\"interval\":60,\"threshold\":25},\"id\":7}";
+	uint8_t packed[256];
+	MsgPackWriter writer(packed, sizeof(packed));
+	writer.writeMap(3);
+	writer.writeString("write");
+	writer.writeString("value");
+	writer.writeString("value");
+	writer.writeMap(4);
+	writer.writeString("ssidPrim");
+	writer.writeString("MyNetwork");
+	writer.writeString("pwPrim");
+	writer.writeString("secret123");
+	writer.writeString("interval");
+	writer.writeInt(60);
+	writer.writeString("threshold");
+	writer.writeInt(25);
+	writer.writeString("id");
+	writer.writeInt(7);
+
+	const uint8_t *jsonData = (const uint8_t *)json;
+	size_t jsonLength = strlen(json);
+	size_t packedLength = writer.size();
+	std::vector<std::string> jsonTokens;
+	std::vector<std::string> packedTokens;
+	parse<JsonPull>(jsonData, jsonLength, &jsonTokens);
+	parse<MsgPackPull>(packed, packedLength, &packedTokens);
+	if (jsonTokens != packedTokens) {
+		fprintf(stderr, "bench_msgpack: the parsers disagree\n");
+		return 1;
+	}
+
+	double jsonUs = Bench_time([&]() { parse<JsonPull>(jsonData, jsonLength, NULL); });
+	double packedUs = Bench_time([&]() { parse<MsgPackPull>(packed, packedLength, NULL); });
+	printf("write:value request, %u tokens\n", (unsigned)jsonTokens.size());
+	printf("JSON        %3u bytes, JsonPull    %6.3f us\n", (unsigned)jsonLength, jsonUs);
+	printf("MessagePack %3u bytes, MsgPackPull %6.3f us\n", (unsigned)packedLength, packedUs);
+	return 0;
+}
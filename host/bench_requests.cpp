@@ -0,0 +1,378 @@
+// Requests of a BLE client against the firmware on the host stand-ins
+//
+// setup() starts ReadBLESerialTask like on the device, the client talks
+// framed JSON over HostBle with a 512 byte MTU. Every case reports the
+// latency from the first request byte to the last reply byte, the bytes
+// of the replies or of the file per run and their bytes/sec. The msgpack
+// cases send the same request as a MessagePack frame, so their replies
+// go through BleSerial_packJson instead of printTo(String). The link
+// itself takes no time, so this is the cost of the firmware, and the
+// 100 ms a download waits for the client to get ready is skipped with
+// HostClock_advance().
+#include <Arduino.h>
+#include <SPIFFS.h>
+#include "HostBle.h"
+#include "Bench.h"
+#include "BleFrame.h"
+#include "BleSerial.h"
+#include "Crc32.h"
+#include "Lzss.h"
+#include "MsgPack.h"
+#include "XorCodec.h"
+#include <stdlib.h>
+#include <string.h>
+#include <random>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+void setup();
+
+#define BENCH_MTU 512
+#define BENCH_TIMEOUT_MS 5000
+
+static XorCodec clientCodec;
+static uint8_t clientSequence = 0;
+
+static void fail(const char *what, const std::string &reply = "")
+{
+	fprintf(stderr, "bench_requests: %s %s\n", what, reply.c_str());
+	fflush(stdout);
+	_exit(1);
+}
+
+static void sendFrame(uint8_t type, const uint8_t *payload, size_t length, bool encode)
+{
+	std::vector<uint8_t> frame(BLE_FRAME_HEADER_SIZE);
+	BleFrameHeader header = { type, clientSequence++, (uint16_t)length };
+	BleFrame_encodeHeader(&frame[0], header);
+	frame.insert(frame.end(), payload, payload + length);
+	if (encode) {
+		clientCodec.reset();
+		clientCodec.apply(&frame[BLE_FRAME_HEADER_SIZE], length);
+	}
+	HostBle_write(&frame[0], frame.size());
+}
+
+static void sendRequest(const std::string &json)
+{
+	sendFrame(BLE_FRAME_JSON, (const uint8_t *)json.data(), json.length(), true);
+}
+
+/** MessagePack request {command: object} */
+static std::string packedRequest(const char *command, const char *object)
+{
+	uint8_t request[64];
+	MsgPackWriter writer(request, sizeof(request));
+	writer.writeMap(1);
+	writer.writeString(command);
+	writer.writeString(object);
+	return std::string((const char *)request, writer.size());
+}
+
+/** Next reply frame, decoded */
+static std::string readReply()
+{
+	uint8_t header[BLE_FRAME_HEADER_SIZE];
+	if (!HostBle_readExactly(header, sizeof(header), BENCH_TIMEOUT_MS))
+		fail("no reply");
+	if (header[0] != BLE_FRAME_MAGIC)
+		fail("reply not framed");
+	size_t length = header[3] | (header[4] << 8);
+	std::string reply(length, '\0');
+	if (!HostBle_readExactly((uint8_t *)&reply[0], length, BENCH_TIMEOUT_MS))
+		fail("reply cut");
+	clientCodec.reset();
+	clientCodec.apply((uint8_t *)&reply[0], length);
+	return reply;
+}
+
+static bool replyHas(const std::string &reply, const char *text)
+{
+	return reply.find(text) != std::string::npos;
+}
+
+/** Number after "key":, -1 if the key is missing */
+static long long replyNumber(const std::string &reply, const char *key)
+{
+	std::string quoted = std::string("\"") + key + "\":";
+	size_t at = reply.find(quoted);
+	if (at == std::string::npos)
+		return -1;
+	return strtoll(reply.c_str() + at + quoted.length(), NULL, 10);
+}
+
+/** Replies up to the one that contains last, returns their bytes */
+static size_t receive(const char *last, std::string *reply = NULL)
+{
+	size_t bytes = 0;
+	while (true) {
+		std::string r = readReply();
+		bytes += r.length();
+		if (replyHas(r, "\"result\":\"failed") || replyHas(r, "\xA6result\xA6" "failed"))
+			fail("request failed", r);
+		if (replyHas(r, last)) {
+			if (reply != NULL)
+				*reply = r;
+			return bytes;
+		}
+	}
+}
+
+/** Request and its replies up to the one that contains last, bytes of the replies */
+static size_t exchange(const std::string &request, const char *last, std::string *reply = NULL,
+	uint8_t type = BLE_FRAME_JSON)
+{
+	sendFrame(type, (const uint8_t *)request.data(), request.length(), true);
+	return receive(last, reply);
+}
+
+template <typename F>
+static void measure(const char *name, int runs, F run)
+{
+	BenchLatency latency;
+	for (int i = 0; i < runs; i++) {
+		double start = Bench_now();
+		size_t bytes = run();
+		latency.add(Bench_now() - start, bytes);
+	}
+	latency.print(name);
+}
+
+static std::vector<uint8_t> randomData(size_t size)
+{
+	std::mt19937 random(1);
+	std::vector<uint8_t> data(size);
+	for (size_t i = 0; i < size; i++)
+		data[i] = random();
+	return data;
+}
+
+/** Text like a configuration dump, LZSS shrinks it */
+static std::vector<uint8_t> textData(size_t size)
+{
+	std::string text;
+	for (int i = 0; text.length() < size; i++) {
+		char line[64];
+		snprintf(line, sizeof(line), "{\"name\":\"config_%03d\",\"value\":\"%d\"},\n", i % 200, i * 7 % 1000);
+		text += line;
+	}
+	return std::vector<uint8_t>(text.begin(), text.begin() + size);
+}
+
+static std::string fileRequest(const char *command, const char *name, const std::vector<uint8_t> &data)
+{
+	char request[160];
+	snprintf(request, sizeof(request), "{\"%s\":\"file\",\"fileName\":\"%s\",\"fileSize\":%u,\"fileCRC\":%u",
+		command, name, (unsigned)data.size(), Crc32::calculate(&data[0], data.size()));
+	return request;
+}
+
+static void sendChunk(const std::vector<uint8_t> &data, size_t offset, size_t length)
+{
+	std::vector<uint8_t> payload(BLE_FRAME_CHUNK_HEADER_SIZE + length);
+	uint32_t crc = Crc32::calculate(&data[offset], length);
+	for (int i = 0; i < 4; i++) {
+		payload[i] = (offset >> (8 * i)) & 0xFF;
+		payload[4 + i] = (crc >> (8 * i)) & 0xFF;
+	}
+	memcpy(&payload[BLE_FRAME_CHUNK_HEADER_SIZE], &data[offset], length);
+	sendFrame(BLE_FRAME_FILE_CHUNK, &payload[0], payload.size(), false);
+}
+
+/** Chunked upload of data, keeps window bytes in flight */
+static size_t uploadChunked(const char *name, const std::vector<uint8_t> &data)
+{
+	std::string reply;
+	exchange(fileRequest("write", name, data) + ",\"chunked\":true}", "\"result\"", &reply);
+	size_t chunkSize = replyNumber(reply, "chunkSize");
+	size_t window = replyNumber(reply, "window");
+	size_t sent = replyNumber(reply, "offset");
+	size_t acked = sent;
+	while (true) {
+		// take the acks that are in, wait for one only if the window is full
+		while (HostBle_available() > 0 || sent >= data.size() || sent - acked >= window) {
+			reply = readReply();
+			if (replyHas(reply, "\"result\"")) {
+				if (!replyHas(reply, "\"result\":\"ok\""))
+					fail("upload failed", reply);
+				return data.size();
+			}
+			if (replyHas(reply, "\"nack\""))
+				sent = acked = replyNumber(reply, "nack");
+			else if (replyHas(reply, "\"ack\""))
+				acked = replyNumber(reply, "ack");
+		}
+		size_t length = data.size() - sent < chunkSize ? data.size() - sent : chunkSize;
+		sendChunk(data, sent, length);
+		sent += length;
+	}
+}
+
+/** Upload of before: raw bytes after the request, no more than the credit allows */
+static size_t uploadLegacy(const char *name, const std::vector<uint8_t> &data)
+{
+	std::string reply;
+	exchange(fileRequest("write", name, data) + "}", "\"result\"", &reply);
+	size_t credit = replyNumber(reply, "credit");
+	size_t sent = 0;
+	while (true) {
+		while (HostBle_available() > 0 || sent >= data.size() || sent >= credit) {
+			reply = readReply();
+			if (replyHas(reply, "\"result\"")) {
+				if (!replyHas(reply, "\"result\":\"ok\"") || sent < data.size())
+					fail("upload failed", reply);
+				return data.size();
+			}
+			if (replyHas(reply, "\"credit\""))
+				credit = replyNumber(reply, "credit");
+		}
+		size_t length = data.size() - sent;
+		if (length > credit - sent)
+			length = credit - sent;
+		if (length > HostBle_frameSize())
+			length = HostBle_frameSize();
+		HostBle_write(&data[sent], length);
+		sent += length;
+	}
+}
+
+/** Wait for the first content byte, letting the wait of the firmware pass at once */
+static size_t readFirst(uint8_t *data, size_t length)
+{
+	for (int i = 0; i < BENCH_TIMEOUT_MS; i++) {
+		HostClock_advance(100);
+		size_t count = HostBle_read(data, length, 1);
+		if (count > 0)
+			return count;
+	}
+	fail("no file content");
+	return 0;
+}
+
+/**
+ * Download name and compare it with data. A read:value request sent right
+ * behind the read:file one must be answered after the content, not within it.
+ */
+static size_t download(const char *name, const std::vector<uint8_t> &data, bool compressed, bool valueBehind = false)
+{
+	std::string request = std::string("{\"read\":\"file\",\"fileName\":\"") + name + "\"";
+	if (compressed)
+		request += ",\"compression\":\"lzss\"";
+	sendRequest(request + "}");
+	if (valueBehind)
+		sendRequest("{\"read\":\"value\"}");
+	std::string reply;
+	receive("\"result\":\"ok\"", &reply);
+	size_t size = replyNumber(reply, "fileSize");
+	if (size != data.size())
+		fail("wrong size", reply);
+	uint32_t notifications = HostBle_notifications();
+
+	std::vector<uint8_t> content(size);
+	std::vector<uint8_t> received(LZSS_BLOCK * 2);
+	LzssDecoder decoder;
+	size_t done = 0;
+	size_t transferred = 0;
+	while (done < size) {
+		// raw content ends after size bytes, the next reply may follow at once
+		size_t wanted = compressed || size - done > received.size() ? received.size() : size - done;
+		size_t count = done == 0 && transferred == 0 ?
+			readFirst(&received[0], wanted) :
+			HostBle_read(&received[0], wanted, BENCH_TIMEOUT_MS);
+		if (count == 0)
+			fail("file content cut");
+		transferred += count;
+		if (compressed == false) {
+			memcpy(&content[done], &received[0], count);
+			done += count;
+			continue;
+		}
+		size_t used = 0;
+		while (used < count && done < size) {
+			size_t consumed;
+			done += decoder.decompress(&received[used], count - used, &consumed, &content[done], size - done);
+			used += consumed;
+		}
+	}
+	if (content != data)
+		fail("file content differs");
+	// every notification but the last is full, the read:value reply may be in already
+	size_t full = (transferred + HostBle_frameSize() - 1) / HostBle_frameSize();
+	if (HostBle_notifications() - notifications > full + (valueBehind ? 1 : 0))
+		fail("file content in partial notifications");
+	if (valueBehind)
+		receive("\"value\"");
+	return size;
+}
+
+int main()
+{
+	char root[] = "/tmp/bench_requestsXXXXXX";
+	if (mkdtemp(root) == NULL)
+		fail("no temp directory");
+	HostFs_setRoot(root);
+	HostFs_setTotalBytes(4 * 1024 * 1024);
+	setup();
+	clientCodec.setKey(apName);
+	HostBle_connect(BENCH_MTU);
+
+	std::string reply;
+	exchange("{\"read\":\"configs\"}", "\"more\":false", &reply);
+	long long schemaHash = replyNumber(reply, "schemaHash");
+	exchange("{\"read\":\"value\"}", "\"value\"", &reply);
+	long long version = replyNumber(reply, "version");
+
+	printf("requests, MTU %d\n", BENCH_MTU);
+	measure("read:configs", 200, []() {
+		return exchange("{\"read\":\"configs\"}", "\"more\":false");
+	});
+	std::string configsPacked = packedRequest("read", "configs");
+	measure("read:configs msgpack", 200, [&configsPacked]() {
+		return exchange(configsPacked, "\xA4more\xC2", NULL, BLE_FRAME_MSGPACK);
+	});
+	char request[96];
+	snprintf(request, sizeof(request), "{\"read\":\"configs\",\"schemaHash\":%lld}", schemaHash);
+	measure("read:configs not modified", 200, [&request]() {
+		return exchange(request, "\"notModified\"");
+	});
+	measure("read:config_index", 200, []() {
+		return exchange("{\"read\":\"config_index\",\"config_index\":0}", "\"config_index\"");
+	});
+	measure("read:value", 200, []() {
+		return exchange("{\"read\":\"value\"}", "\"value\"");
+	});
+	std::string valuePacked = packedRequest("read", "value");
+	measure("read:value msgpack", 200, [&valuePacked]() {
+		return exchange(valuePacked, "\xA5value", NULL, BLE_FRAME_MSGPACK);
+	});
+	char valueRequest[96];
+	snprintf(valueRequest, sizeof(valueRequest), "{\"read\":\"value\",\"version\":%lld}", version);
+	measure("read:value not modified", 200, [&valueRequest]() {
+		return exchange(valueRequest, "\"notModified\"");
+	});
+
+	const size_t fileSize = 64 * 1024;
+	std::vector<uint8_t> binary = randomData(fileSize);
+	std::vector<uint8_t> text = textData(fileSize);
+	measure("write:file chunked 64 KB", 10, [&binary]() {
+		return uploadChunked("/bench.bin", binary);
+	});
+	measure("write:file 64 KB", 10, [&binary]() {
+		return uploadLegacy("/bench.bin", binary);
+	});
+	uploadChunked("/bench.txt", text);
+	measure("read:file 64 KB", 10, [&binary]() {
+		return download("/bench.bin", binary, false);
+	});
+	measure("read:file lzss 64 KB text", 10, [&text]() {
+		return download("/bench.txt", text, true);
+	});
+	measure("read:file 64 KB, read:value", 10, [&binary]() {
+		return download("/bench.bin", binary, false, true);
+	});
+
+	fflush(stdout);
+	// the firmware tasks never end
+	_exit(0);
+}
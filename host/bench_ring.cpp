@@ -0,0 +1,119 @@
+// ByteRingBuffer against the class it replaced, which took bytes one by
+// one with a modulo per byte and overwrote the oldest byte when full.
+// One thread fills the ring to 3/4 and drains it again, in the piece
+// sizes BleSerial uses: single bytes, 20 byte GATT writes of the default
+// MTU and 509 byte ones of the largest.
+#include "ByteRingBuffer.h"
+#include "Bench.h"
+#include <stdio.h>
+#include <string.h>
+
+namespace old {
+
+template <size_t N>
+class ByteRingBuffer
+{
+private:
+	uint8_t buffer[N];
+	int head = 0;
+	int tail = 0;
+
+public:
+	void add(uint8_t value)
+	{
+		buffer[head] = value;
+		head = (head + 1) % N;
+		if (head == tail)
+		{
+			tail = (tail + 1) % N;
+		}
+	}
+	uint8_t pop()
+	{
+		// pops the oldest value off the ring buffer
+		if (head == tail)
+		{
+			return -1;
+		}
+		else
+		{
+			uint8_t value = buffer[tail];
+			tail = (tail + 1) % N;
+			return value;
+		}
+	}
+
+	size_t getLength()
+	{
+		if (head >= tail)
+		{
+			return head - tail;
+		}
+		else
+		{
+			return N - tail + head;
+		}
+	}
+};
+
+}
+
+// BUFFER_SIZE of BleSerial.cpp
+#define BENCH_RING_SIZE 4096
+#define BENCH_RING_FILL (BENCH_RING_SIZE * 3 / 4)
+
+static old::ByteRingBuffer<BENCH_RING_SIZE> oldRing;
+static ByteRingBuffer<BENCH_RING_SIZE> ring;
+static uint8_t data[BENCH_RING_FILL];
+
+/** The old class in the loops BleSerial had, a byte per call */
+static void oldRun(size_t piece)
+{
+	uint32_t sum = 0;
+	for (size_t done = 0; done < BENCH_RING_FILL; done += piece)
+		for (size_t i = 0; i < piece && done + i < BENCH_RING_FILL; i++)
+			oldRing.add(data[done + i]);
+	uint8_t out[512];
+	while (oldRing.getLength() > 0) {
+		size_t length = 0;
+		while (length < piece && oldRing.getLength() > 0)
+			out[length++] = oldRing.pop();
+		sum += out[length - 1];
+	}
+	bench_sink += sum;
+}
+
+static void run(size_t piece)
+{
+	uint32_t sum = 0;
+	if (piece == 1) {
+		for (size_t done = 0; done < BENCH_RING_FILL; done++)
+			ring.add(data[done]);
+		while (ring.getLength() > 0)
+			sum += ring.pop();
+	} else {
+		for (size_t done = 0; done < BENCH_RING_FILL; done += piece)
+			ring.push(&data[done], piece < BENCH_RING_FILL - done ? piece : BENCH_RING_FILL - done);
+		uint8_t out[512];
+		size_t length;
+		while ((length = ring.pop(out, piece)) > 0)
+			sum += out[length - 1];
+	}
+	bench_sink += sum;
+}
+
+int main()
+{
+	for (size_t i = 0; i < sizeof(data); i++)
+		data[i] = i * 7;
+	const size_t pieces[] = { 1, 20, 509 };
+	printf("ring buffer, %d bytes in and out per run\n", BENCH_RING_FILL);
+	for (size_t i = 0; i < sizeof(pieces) / sizeof(pieces[0]); i++) {
+		size_t piece = pieces[i];
+		double oldUs = Bench_time([piece]() { oldRun(piece); });
+		double newUs = Bench_time([piece]() { run(piece); });
+		printf("pieces of %3u bytes: old %8.1f MB/s, new %8.1f MB/s, %5.1fx\n", (unsigned)piece,
+			Bench_mbps(2 * BENCH_RING_FILL, oldUs), Bench_mbps(2 * BENCH_RING_FILL, newUs), oldUs / newUs);
+	}
+	return 0;
+}
@@ -0,0 +1,69 @@
+// BleSerial_writev against the byte loop BleSerial_write(buffer, size)
+// had before: BleSerial_write(uint8_t) for every byte, then a flush.
+// The single byte write is today's, it fills the same TX frames.
+// Both send a framed reply, the 5 byte header and the payload, through
+// the TX queue to a client with a 512 byte MTU. A run sends 64 replies
+// and ends when the client has received all of their bytes.
+#include <Arduino.h>
+#include "HostBle.h"
+#include "Bench.h"
+#include "BleSerial.h"
+#include <vector>
+#include <unistd.h>
+
+#define BENCH_MTU 512
+#define BENCH_REPLIES 64
+#define BENCH_HEADER_SIZE 5
+
+static void byteLoop(const uint8_t *header, const uint8_t *payload, size_t length)
+{
+	for (size_t i = 0; i < BENCH_HEADER_SIZE; i++)
+		BleSerial_write(header[i]);
+	for (size_t i = 0; i < length; i++)
+		BleSerial_write(payload[i]);
+	BleSerial_flush();
+}
+
+static void writev(const uint8_t *header, const uint8_t *payload, size_t length)
+{
+	BleSerialSpan spans[] = {
+		{ header, BENCH_HEADER_SIZE },
+		{ payload, length },
+	};
+	BleSerial_writev(spans, 2);
+}
+
+template <typename F>
+static double run(F write, size_t length)
+{
+	static uint8_t header[BENCH_HEADER_SIZE] = { 0xA5, 1, 0, 0, 0 };
+	std::vector<uint8_t> payload(length, 'x');
+	std::vector<uint8_t> received((BENCH_HEADER_SIZE + length) * BENCH_REPLIES);
+	return Bench_time([&]() {
+		for (int i = 0; i < BENCH_REPLIES; i++)
+			write(header, &payload[0], length);
+		if (!HostBle_readExactly(&received[0], received.size(), 5000)) {
+			fprintf(stderr, "bench_writev: replies lost\n");
+			_exit(1);
+		}
+	});
+}
+
+int main()
+{
+	initBLE();
+	HostBle_connect(BENCH_MTU);
+	const size_t lengths[] = { 60, 400, 2048 };
+	printf("framed replies to a %d byte MTU, %d per run\n", BENCH_MTU, BENCH_REPLIES);
+	for (size_t i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++) {
+		size_t length = lengths[i];
+		size_t bytes = (BENCH_HEADER_SIZE + length) * BENCH_REPLIES;
+		double loopUs = run(byteLoop, length);
+		double writevUs = run(writev, length);
+		printf("payload %4u bytes: byte loop %7.1f MB/s, writev %7.1f MB/s, %4.1fx\n", (unsigned)length,
+			Bench_mbps(bytes, loopUs), Bench_mbps(bytes, writevUs), loopUs / writevUs);
+	}
+	fflush(stdout);
+	// the TX task never ends
+	_exit(0);
+}
@@ -0,0 +1,46 @@
+// XorCodec against BleSerial_encode/decode of before, which looked up the
+// key length with strlen() for every byte. The old functions also printed
+// the first bytes to Serial, that output is left out here so only the
+// XOR loops are compared. The key is the apName of the host stand-ins.
+#include "XorCodec.h"
+#include "Bench.h"
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+static char benchKey[] = "ESP32-240AC4000001";
+
+static void oldEncode(uint8_t *value, uint32_t value_size)
+{
+	int keyIndex = 0;
+	for (int index = 0; index < value_size; index ++) {
+		value[index] = (char) value[index] ^ (char) benchKey[keyIndex];
+		keyIndex++;
+		if (keyIndex >= strlen(benchKey)) keyIndex = 0;
+	}
+}
+
+int main()
+{
+	XorCodec codec;
+	codec.setKey(benchKey);
+	const size_t lengths[] = { 20, 509, 4096 };
+	printf("XOR coding, key of %u bytes\n", (unsigned)strlen(benchKey));
+	for (size_t i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++) {
+		size_t length = lengths[i];
+		std::vector<uint8_t> data(length, 'x');
+		uint8_t *p = &data[0];
+		double oldUs = Bench_time([p, length]() {
+			oldEncode(p, length);
+			bench_sink += p[length - 1];
+		});
+		double newUs = Bench_time([p, length, &codec]() {
+			codec.reset();
+			codec.apply(p, length);
+			bench_sink += p[length - 1];
+		});
+		printf("%4u bytes: old %8.1f MB/s, XorCodec %8.1f MB/s, %5.1fx\n", (unsigned)length,
+			Bench_mbps(length, oldUs), Bench_mbps(length, newUs), oldUs / newUs);
+	}
+	return 0;
+}
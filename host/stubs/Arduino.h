@@ -0,0 +1,66 @@
+// Arduino core stand-in for host builds
+//
+// millis() and micros() run on the HostClock: the steady clock of the host
+// plus whatever HostClock_advance() added, so a test can let deadlines pass
+// without waiting for them. Serial prints to stderr.
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "WString.h"
+
+typedef uint8_t byte;
+
+using std::min;
+using std::max;
+
+unsigned long millis();
+unsigned long micros();
+void delay(uint32_t ms);
+
+/** Move millis() and micros() forward, timeouts that pass end at once */
+void HostClock_advance(uint32_t ms);
+
+class HardwareSerial
+{
+public:
+	void begin(unsigned long baud) {}
+	size_t print(const char *s) { return fputs(s, stderr) >= 0 ? strlen(s) : 0; }
+	size_t print(const String &s) { return print(s.c_str()); }
+	size_t print(char c) { return fputc(c, stderr) != EOF; }
+	size_t print(int value) { return fprintf(stderr, "%d", value); }
+	size_t print(unsigned int value) { return fprintf(stderr, "%u", value); }
+	size_t print(long value) { return fprintf(stderr, "%ld", value); }
+	size_t print(unsigned long value) { return fprintf(stderr, "%lu", value); }
+	size_t println() { return print("\r\n"); }
+	template <typename T>
+	size_t println(T value) { return print(value) + println(); }
+	size_t printf(const char *format, ...) __attribute__((format(printf, 2, 3)));
+};
+
+extern HardwareSerial Serial;
+
+class EspClass
+{
+public:
+	/** Ends the process, there is nothing to boot again */
+	void restart();
+};
+
+extern EspClass ESP;
+
+typedef enum {
+	ESP_MAC_WIFI_STA,
+	ESP_MAC_WIFI_SOFTAP,
+	ESP_MAC_BT,
+	ESP_MAC_ETH,
+} esp_mac_type_t;
+
+uint32_t esp_random();
+/** Always 24:0A:C4:00:00:01, the device name depends on it */
+esp_err_t esp_read_mac(uint8_t *mac, esp_mac_type_t type);
@@ -0,0 +1,200 @@
+// BLE stand-in for host builds
+//
+// The classes of the ESP32 BLE library that BleSerial.cpp uses, on the
+// server side of a simulated link. HostBle.h is the client side: it
+// connects, writes characteristics and collects notifications. A notify
+// reaches the client at once and is confirmed with ESP_GATTS_CONF_EVT,
+// the stack events go to the custom GATTS handler like on the ESP32.
+#pragma once
+#include <Arduino.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#define ESP_GATT_MAX_ATTR_LEN 600
+#define ESP_GATT_PERM_READ (1 << 0)
+#define ESP_GATT_PERM_READ_ENCRYPTED (1 << 1)
+#define ESP_GATT_PERM_WRITE (1 << 4)
+#define ESP_GATT_PERM_WRITE_ENCRYPTED (1 << 5)
+
+typedef uint8_t esp_gatt_if_t;
+
+typedef enum {
+	ESP_GATTS_REG_EVT = 0,
+	ESP_GATTS_READ_EVT = 1,
+	ESP_GATTS_WRITE_EVT = 2,
+	ESP_GATTS_MTU_EVT = 4,
+	ESP_GATTS_CONF_EVT = 5,
+	ESP_GATTS_CONNECT_EVT = 14,
+	ESP_GATTS_DISCONNECT_EVT = 15,
+	ESP_GATTS_CONGEST_EVT = 24,
+} esp_gatts_cb_event_t;
+
+/** The members of the GATTS event parameters that exist on the host */
+typedef union {
+	struct {
+		uint16_t conn_id;
+	} connect;
+	struct {
+		uint16_t conn_id;
+	} disconnect;
+	struct {
+		uint16_t conn_id;
+		uint16_t mtu;
+	} mtu;
+	struct {
+		int status;
+		uint16_t conn_id;
+		uint16_t handle;
+	} conf;
+	struct {
+		uint16_t conn_id;
+		bool congested;
+	} congest;
+} esp_ble_gatts_cb_param_t;
+
+typedef void (*gatts_event_handler)(esp_gatts_cb_event_t event, esp_gatt_if_t gatts_if, esp_ble_gatts_cb_param_t *param);
+
+typedef enum {
+	ESP_PWR_LVL_N12,
+	ESP_PWR_LVL_N9,
+	ESP_PWR_LVL_N6,
+	ESP_PWR_LVL_N3,
+	ESP_PWR_LVL_N0,
+	ESP_PWR_LVL_P3,
+	ESP_PWR_LVL_P6,
+	ESP_PWR_LVL_P9,
+} esp_power_level_t;
+
+class BLEUUID
+{
+public:
+	BLEUUID(const char *uuid) : value(uuid) {}
+	std::string toString() const { return value; }
+
+private:
+	std::string value;
+};
+
+class BLEDescriptor
+{
+public:
+	virtual ~BLEDescriptor() {}
+};
+
+class BLE2902 : public BLEDescriptor
+{
+};
+
+class BLECharacteristic;
+
+class BLECharacteristicCallbacks
+{
+public:
+	typedef enum {
+		SUCCESS_INDICATE,
+		SUCCESS_NOTIFY,
+		ERROR_INDICATE_DISABLED,
+		ERROR_NOTIFY_DISABLED,
+		ERROR_GATT,
+		ERROR_NO_CLIENT,
+		ERROR_INDICATE_TIMEOUT,
+		ERROR_INDICATE_FAILURE
+	} Status;
+
+	virtual ~BLECharacteristicCallbacks() {}
+	virtual void onRead(BLECharacteristic *pCharacteristic) {}
+	virtual void onWrite(BLECharacteristic *pCharacteristic) {}
+	virtual void onNotify(BLECharacteristic *pCharacteristic) {}
+	virtual void onStatus(BLECharacteristic *pCharacteristic, Status s, uint32_t code) {}
+};
+
+class BLECharacteristic
+{
+public:
+	static const uint32_t PROPERTY_READ = 1 << 0;
+	static const uint32_t PROPERTY_WRITE = 1 << 1;
+	static const uint32_t PROPERTY_NOTIFY = 1 << 2;
+	static const uint32_t PROPERTY_BROADCAST = 1 << 3;
+	static const uint32_t PROPERTY_INDICATE = 1 << 4;
+	static const uint32_t PROPERTY_WRITE_NR = 1 << 5;
+
+	BLECharacteristic(const char *uuid, uint32_t properties, uint16_t handle);
+
+	BLEUUID getUUID() { return uuid; }
+	uint16_t getHandle() { return handle; }
+	uint32_t getProperties() { return properties; }
+	std::string getValue();
+	void setValue(uint8_t *data, size_t length);
+	void setValue(const std::string &value);
+	void notify(bool isNotification = true);
+	void setAccessPermissions(uint16_t permissions) {}
+	void addDescriptor(BLEDescriptor *descriptor) {}
+	void setReadProperty(bool value) { setProperty(PROPERTY_READ, value); }
+	void setWriteProperty(bool value) { setProperty(PROPERTY_WRITE, value); }
+	void setNotifyProperty(bool value) { setProperty(PROPERTY_NOTIFY, value); }
+	void setCallbacks(BLECharacteristicCallbacks *callbacks) { this->callbacks = callbacks; }
+	BLECharacteristicCallbacks *getCallbacks() { return callbacks; }
+
+private:
+	BLEUUID uuid;
+	uint32_t properties;
+	uint16_t handle;
+	std::mutex valueMutex;
+	std::string value;
+	BLECharacteristicCallbacks *callbacks;
+
+	void setProperty(uint32_t property, bool value)
+	{
+		properties = value ? properties | property : properties & ~property;
+	}
+};
+
+class BLEService
+{
+public:
+	BLECharacteristic *createCharacteristic(const char *uuid, uint32_t properties);
+	void start() {}
+};
+
+class BLEAdvertising
+{
+public:
+	void start() {}
+	void stop() {}
+};
+
+class BLEServer;
+
+class BLEServerCallbacks
+{
+public:
+	virtual ~BLEServerCallbacks() {}
+	virtual void onConnect(BLEServer *pServer) {}
+	virtual void onDisconnect(BLEServer *pServer) {}
+};
+
+class BLEServer
+{
+public:
+	BLEService *createService(const char *uuid);
+	uint32_t getConnectedCount();
+	void setCallbacks(BLEServerCallbacks *callbacks) { this->callbacks = callbacks; }
+	BLEServerCallbacks *getCallbacks() { return callbacks; }
+	BLEAdvertising *getAdvertising() { return &advertising; }
+
+private:
+	BLEServerCallbacks *callbacks = NULL;
+	BLEAdvertising advertising;
+};
+
+class BLEDevice
+{
+public:
+	static void init(const std::string &deviceName) {}
+	static void setPower(esp_power_level_t powerLevel) {}
+	static BLEServer *createServer();
+	static void setCustomGattsHandler(gatts_event_handler handler);
+};
@@ -0,0 +1,3 @@
+// BLE stand-in for host builds, see BLEDevice.h
+#pragma once
+#include "BLEDevice.h"
@@ -0,0 +1,67 @@
+// Arduino FS stand-in for host builds
+//
+// A flat filesystem like SPIFFS: "/a/b" is one file whose name contains a
+// slash. Files live in a host directory with '/' and '%' of a name escaped
+// as %2F and %25. Only the root can be opened as a directory.
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <memory>
+#include <string>
+#include "WString.h"
+
+#define FILE_READ "r"
+#define FILE_WRITE "w"
+#define FILE_APPEND "a"
+
+namespace fs
+{
+
+struct FileImpl;
+
+class File
+{
+public:
+	File(std::shared_ptr<FileImpl> impl = std::shared_ptr<FileImpl>()) : impl(impl) {}
+
+	size_t write(uint8_t value);
+	size_t write(const uint8_t *data, size_t length);
+	size_t print(const char *s);
+	size_t print(const String &s) { return print(s.c_str()); }
+	int available();
+	int read();
+	size_t read(uint8_t *data, size_t length);
+	void flush();
+	bool seek(uint32_t position);
+	size_t position() const;
+	size_t size() const;
+	void close();
+	operator bool() const;
+	/** Name without the leading '/', like the ESP32 core 2.x */
+	const char *name() const;
+	const char *path() const;
+	bool isDirectory() const;
+	File openNextFile(const char *mode = FILE_READ);
+
+private:
+	std::shared_ptr<FileImpl> impl;
+};
+
+class FS
+{
+public:
+	File open(const char *path, const char *mode = FILE_READ, bool create = false);
+	File open(const String &path, const char *mode = FILE_READ) { return open(path.c_str(), mode); }
+	bool exists(const char *path);
+	bool remove(const char *path);
+	bool rename(const char *pathFrom, const char *pathTo);
+
+protected:
+	/** Host directory of the files, empty until mounted */
+	std::string root;
+};
+
+} // namespace fs
+
+using fs::FS;
+using fs::File;
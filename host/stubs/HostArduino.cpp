@@ -0,0 +1,41 @@
+#include <Arduino.h>
+#include <WiFi.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <mutex>
+#include <random>
+
+HardwareSerial Serial;
+EspClass ESP;
+WiFiClass WiFi;
+
+size_t HardwareSerial::printf(const char *format, ...)
+{
+    va_list list;
+    va_start(list, format);
+    int length = vfprintf(stderr, format, list);
+    va_end(list);
+    return length > 0 ? length : 0;
+}
+
+void EspClass::restart()
+{
+    fputs("ESP.restart()\n", stderr);
+    fflush(stderr);
+    _exit(0);
+}
+
+uint32_t esp_random()
+{
+    static std::mutex mutex;
+    static std::mt19937 generator(std::random_device{}());
+    std::lock_guard<std::mutex> lock(mutex);
+    return generator();
+}
+
+esp_err_t esp_read_mac(uint8_t *mac, esp_mac_type_t type)
+{
+    static const uint8_t hostMac[6] = { 0x24, 0x0A, 0xC4, 0x00, 0x00, 0x01 };
+    memcpy(mac, hostMac, sizeof(hostMac));
+    return ESP_OK;
+}
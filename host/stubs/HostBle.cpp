@@ -0,0 +1,219 @@
+#include <BLEDevice.h>
+#include "HostBle.h"
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+
+#define HOST_BLE_NOTIFY_HEADER_SIZE 3
+
+static BLEServer *hostServer = NULL;
+static gatts_event_handler hostGattsHandler = NULL;
+static std::vector<BLECharacteristic *> hostCharacteristics;
+static uint16_t hostNextHandle = 40;
+static volatile uint32_t hostConnected = 0;
+static volatile uint16_t hostMtu = 23;
+
+static std::mutex clientMutex;
+static std::condition_variable clientChanged;
+static std::deque<uint8_t> clientReceived;
+static uint32_t clientNotifications = 0;
+
+static void HostBle_event(esp_gatts_cb_event_t event, esp_ble_gatts_cb_param_t *param)
+{
+    if (hostGattsHandler != NULL)
+    {
+        hostGattsHandler(event, 3, param);
+    }
+}
+
+BLECharacteristic::BLECharacteristic(const char *uuid, uint32_t properties, uint16_t handle)
+    : uuid(uuid), properties(properties), handle(handle), callbacks(NULL)
+{
+}
+
+std::string BLECharacteristic::getValue()
+{
+    std::lock_guard<std::mutex> lock(valueMutex);
+    return value;
+}
+
+void BLECharacteristic::setValue(uint8_t *data, size_t length)
+{
+    std::lock_guard<std::mutex> lock(valueMutex);
+    value.assign((const char *)data, length);
+}
+
+void BLECharacteristic::setValue(const std::string &value)
+{
+    std::lock_guard<std::mutex> lock(valueMutex);
+    this->value = value;
+}
+
+void BLECharacteristic::notify(bool isNotification)
+{
+    if (hostConnected == 0)
+    {
+        if (callbacks != NULL)
+        {
+            callbacks->onStatus(this, BLECharacteristicCallbacks::ERROR_NO_CLIENT, 0);
+        }
+        return;
+    }
+    std::string notified = getValue();
+    if (notified.length() > (size_t)hostMtu - HOST_BLE_NOTIFY_HEADER_SIZE)
+    {
+        // the stack cuts a notification to the MTU
+        notified.resize(hostMtu - HOST_BLE_NOTIFY_HEADER_SIZE);
+    }
+    {
+        std::lock_guard<std::mutex> lock(clientMutex);
+        clientReceived.insert(clientReceived.end(), notified.begin(), notified.end());
+        clientNotifications++;
+    }
+    clientChanged.notify_all();
+    if (callbacks != NULL)
+    {
+        callbacks->onStatus(this, BLECharacteristicCallbacks::SUCCESS_NOTIFY, 0);
+    }
+    esp_ble_gatts_cb_param_t param;
+    param.conf.status = 0;
+    param.conf.conn_id = 0;
+    param.conf.handle = handle;
+    HostBle_event(ESP_GATTS_CONF_EVT, &param);
+}
+
+BLECharacteristic *BLEService::createCharacteristic(const char *uuid, uint32_t properties)
+{
+    BLECharacteristic *characteristic = new BLECharacteristic(uuid, properties, hostNextHandle);
+    hostNextHandle += 2;
+    hostCharacteristics.push_back(characteristic);
+    return characteristic;
+}
+
+BLEService *BLEServer::createService(const char *uuid)
+{
+    return new BLEService();
+}
+
+uint32_t BLEServer::getConnectedCount()
+{
+    return hostConnected;
+}
+
+BLEServer *BLEDevice::createServer()
+{
+    hostServer = new BLEServer();
+    return hostServer;
+}
+
+void BLEDevice::setCustomGattsHandler(gatts_event_handler handler)
+{
+    hostGattsHandler = handler;
+}
+
+void HostBle_connect(uint16_t mtu)
+{
+    esp_ble_gatts_cb_param_t param;
+    hostMtu = 23;
+    hostConnected = 1;
+    param.connect.conn_id = 0;
+    HostBle_event(ESP_GATTS_CONNECT_EVT, &param);
+    if (hostServer != NULL && hostServer->getCallbacks() != NULL)
+    {
+        hostServer->getCallbacks()->onConnect(hostServer);
+    }
+    hostMtu = mtu;
+    param.mtu.conn_id = 0;
+    param.mtu.mtu = mtu;
+    HostBle_event(ESP_GATTS_MTU_EVT, &param);
+}
+
+void HostBle_disconnect()
+{
+    esp_ble_gatts_cb_param_t param;
+    hostConnected = 0;
+    param.disconnect.conn_id = 0;
+    HostBle_event(ESP_GATTS_DISCONNECT_EVT, &param);
+    if (hostServer != NULL && hostServer->getCallbacks() != NULL)
+    {
+        hostServer->getCallbacks()->onDisconnect(hostServer);
+    }
+}
+
+size_t HostBle_frameSize()
+{
+    return hostMtu - HOST_BLE_NOTIFY_HEADER_SIZE;
+}
+
+void HostBle_write(const uint8_t *data, size_t length)
+{
+    BLECharacteristic *characteristic = NULL;
+    for (size_t i = 0; i < hostCharacteristics.size(); i++)
+    {
+        if (hostCharacteristics[i]->getProperties() & BLECharacteristic::PROPERTY_WRITE)
+        {
+            characteristic = hostCharacteristics[i];
+            break;
+        }
+    }
+    if (characteristic == NULL || hostConnected == 0)
+    {
+        return;
+    }
+    size_t frameSize = HostBle_frameSize();
+    for (size_t offset = 0; offset < length; offset += frameSize)
+    {
+        size_t slice = length - offset < frameSize ? length - offset : frameSize;
+        characteristic->setValue((uint8_t *)data + offset, slice);
+        if (characteristic->getCallbacks() != NULL)
+        {
+            characteristic->getCallbacks()->onWrite(characteristic);
+        }
+    }
+}
+
+size_t HostBle_available()
+{
+    std::lock_guard<std::mutex> lock(clientMutex);
+    return clientReceived.size();
+}
+
+/** Wait until wanted bytes are notified, then copy up to length of them */
+static size_t HostBle_take(uint8_t *data, size_t length, size_t wanted, uint32_t timeoutMs)
+{
+    std::unique_lock<std::mutex> lock(clientMutex);
+    if (!clientChanged.wait_for(lock, std::chrono::milliseconds(timeoutMs),
+            [wanted]() { return clientReceived.size() >= wanted; }))
+    {
+        return 0;
+    }
+    if (length > clientReceived.size())
+    {
+        length = clientReceived.size();
+    }
+    std::copy(clientReceived.begin(), clientReceived.begin() + length, data);
+    clientReceived.erase(clientReceived.begin(), clientReceived.begin() + length);
+    return length;
+}
+
+size_t HostBle_read(uint8_t *data, size_t length, uint32_t timeoutMs)
+{
+    return length > 0 ? HostBle_take(data, length, 1, timeoutMs) : 0;
+}
+
+bool HostBle_readExactly(uint8_t *data, size_t length, uint32_t timeoutMs)
+{
+    return length == 0 || HostBle_take(data, length, length, timeoutMs) == length;
+}
+
+void HostBle_clear()
+{
+    std::lock_guard<std::mutex> lock(clientMutex);
+    clientReceived.clear();
+}
+
+uint32_t HostBle_notifications()
+{
+    std::lock_guard<std::mutex> lock(clientMutex);
+    return clientNotifications;
+}
@@ -0,0 +1,28 @@
+// Client side of the BLE stand-in, see BLEDevice.h
+//
+// One client with connection id 0. Writes run the onWrite callback on the
+// calling thread, like the BLE task of the ESP32 does. Timeouts of the
+// client are wall clock milliseconds, not HostClock ones.
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+/** Connect and exchange the MTU, the server sees both events */
+void HostBle_connect(uint16_t mtu);
+void HostBle_disconnect();
+/** Payload of one GATT write or notification, MTU - 3 */
+size_t HostBle_frameSize();
+
+/** Write to the writable characteristic in GATT writes of at most HostBle_frameSize() bytes */
+void HostBle_write(const uint8_t *data, size_t length);
+
+/** Notified bytes not read yet */
+size_t HostBle_available();
+/** Copy up to length notified bytes, waits up to timeoutMs for the first one */
+size_t HostBle_read(uint8_t *data, size_t length, uint32_t timeoutMs);
+/** Copy length notified bytes, false if they did not arrive within timeoutMs */
+bool HostBle_readExactly(uint8_t *data, size_t length, uint32_t timeoutMs);
+/** Drop every notified byte not read yet */
+void HostBle_clear();
+/** Notifications received since the start */
+uint32_t HostBle_notifications();
@@ -0,0 +1,356 @@
+#include <FS.h>
+#include <SPIFFS.h>
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <vector>
+
+namespace fs
+{
+
+/**
+ * FileImpl
+ * An open file or the root directory with the names found when it was opened
+ */
+struct FileImpl {
+    FILE *stream;
+    std::string path; // with the leading '/'
+    std::string hostRoot;
+    bool directory;
+    std::vector<std::string> entries;
+    size_t nextEntry;
+
+    ~FileImpl()
+    {
+        if (stream != NULL)
+        {
+            fclose(stream);
+        }
+    }
+};
+
+} // namespace fs
+
+SPIFFSFS SPIFFS;
+static std::string hostFsRoot;
+static size_t hostFsTotalBytes = 49196;
+
+void HostFs_setRoot(const char *directory)
+{
+    hostFsRoot = directory;
+}
+
+const char *HostFs_getRoot()
+{
+    return hostFsRoot.c_str();
+}
+
+void HostFs_setTotalBytes(size_t bytes)
+{
+    hostFsTotalBytes = bytes;
+}
+
+/** Host file of a name without the leading '/' */
+static std::string HostFs_escape(const std::string &root, const std::string &name)
+{
+    std::string hostPath = root + "/";
+    for (size_t i = 0; i < name.length(); i++)
+    {
+        if (name[i] == '/')
+        {
+            hostPath += "%2F";
+        }
+        else if (name[i] == '%')
+        {
+            hostPath += "%25";
+        }
+        else
+        {
+            hostPath += name[i];
+        }
+    }
+    return hostPath;
+}
+
+static std::string HostFs_unescape(const char *hostName)
+{
+    std::string name;
+    for (const char *c = hostName; *c; c++)
+    {
+        if (c[0] == '%' && c[1] == '2' && (c[2] == 'F' || c[2] == '5'))
+        {
+            name += c[2] == 'F' ? '/' : '%';
+            c += 2;
+        }
+        else
+        {
+            name += *c;
+        }
+    }
+    return name;
+}
+
+/** Names of all files, sorted so that listings are repeatable */
+static std::vector<std::string> HostFs_list(const std::string &root)
+{
+    std::vector<std::string> names;
+    DIR *dir = opendir(root.c_str());
+    if (dir == NULL)
+    {
+        return names;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL)
+    {
+        if (entry->d_name[0] != '.')
+        {
+            names.push_back(HostFs_unescape(entry->d_name));
+        }
+    }
+    closedir(dir);
+    std::sort(names.begin(), names.end());
+    return names;
+}
+
+namespace fs
+{
+
+File FS::open(const char *path, const char *mode, bool create)
+{
+    if (root.empty() || path == NULL || path[0] != '/')
+    {
+        return File();
+    }
+    std::shared_ptr<FileImpl> impl(new FileImpl());
+    impl->stream = NULL;
+    impl->path = path;
+    impl->hostRoot = root;
+    impl->directory = false;
+    impl->nextEntry = 0;
+    if (strcmp(path, "/") == 0)
+    {
+        impl->directory = true;
+        impl->entries = HostFs_list(root);
+        return File(impl);
+    }
+    const char *hostMode = mode[0] == 'w' ? "w+b" : mode[0] == 'a' ? "a+b" : "rb";
+    impl->stream = fopen(HostFs_escape(root, path + 1).c_str(), hostMode);
+    if (impl->stream == NULL)
+    {
+        return File();
+    }
+    return File(impl);
+}
+
+bool FS::exists(const char *path)
+{
+    return open(path) ? true : false;
+}
+
+bool FS::remove(const char *path)
+{
+    if (root.empty() || path[0] != '/')
+    {
+        return false;
+    }
+    return ::remove(HostFs_escape(root, path + 1).c_str()) == 0;
+}
+
+bool FS::rename(const char *pathFrom, const char *pathTo)
+{
+    if (root.empty() || pathFrom[0] != '/' || pathTo[0] != '/' || !exists(pathFrom))
+    {
+        return false;
+    }
+    return ::rename(HostFs_escape(root, pathFrom + 1).c_str(), HostFs_escape(root, pathTo + 1).c_str()) == 0;
+}
+
+size_t File::write(uint8_t value)
+{
+    return write(&value, 1);
+}
+
+size_t File::write(const uint8_t *data, size_t length)
+{
+    if (!impl || impl->stream == NULL)
+    {
+        return 0;
+    }
+    return fwrite(data, 1, length, impl->stream);
+}
+
+size_t File::print(const char *s)
+{
+    return write((const uint8_t *)s, strlen(s));
+}
+
+int File::available()
+{
+    if (!impl || impl->stream == NULL)
+    {
+        return 0;
+    }
+    return size() - position();
+}
+
+int File::read()
+{
+    uint8_t value;
+    return read(&value, 1) == 1 ? value : -1;
+}
+
+size_t File::read(uint8_t *data, size_t length)
+{
+    if (!impl || impl->stream == NULL)
+    {
+        return 0;
+    }
+    return fread(data, 1, length, impl->stream);
+}
+
+void File::flush()
+{
+    if (impl && impl->stream != NULL)
+    {
+        fflush(impl->stream);
+    }
+}
+
+bool File::seek(uint32_t position)
+{
+    return impl && impl->stream != NULL && fseek(impl->stream, position, SEEK_SET) == 0;
+}
+
+size_t File::position() const
+{
+    if (!impl || impl->stream == NULL)
+    {
+        return 0;
+    }
+    long position = ftell(impl->stream);
+    return position > 0 ? position : 0;
+}
+
+size_t File::size() const
+{
+    if (!impl || impl->stream == NULL)
+    {
+        return 0;
+    }
+    fflush(impl->stream);
+    struct stat info;
+    if (fstat(fileno(impl->stream), &info) != 0)
+    {
+        return 0;
+    }
+    return info.st_size;
+}
+
+void File::close()
+{
+    impl.reset();
+}
+
+File::operator bool() const
+{
+    return impl ? true : false;
+}
+
+const char *File::name() const
+{
+    return impl ? impl->path.c_str() + 1 : NULL;
+}
+
+const char *File::path() const
+{
+    return impl ? impl->path.c_str() : NULL;
+}
+
+bool File::isDirectory() const
+{
+    return impl && impl->directory;
+}
+
+File File::openNextFile(const char *mode)
+{
+    while (impl && impl->directory && impl->nextEntry < impl->entries.size())
+    {
+        std::string path = "/" + impl->entries[impl->nextEntry++];
+        std::shared_ptr<FileImpl> next(new FileImpl());
+        next->stream = fopen(HostFs_escape(impl->hostRoot, path.substr(1)).c_str(), "rb");
+        next->path = path;
+        next->hostRoot = impl->hostRoot;
+        next->directory = false;
+        next->nextEntry = 0;
+        if (next->stream != NULL)
+        {
+            return File(next);
+        }
+    }
+    return File();
+}
+
+} // namespace fs
+
+bool SPIFFSFS::begin(bool formatOnFail, const char *basePath, uint8_t maxOpenFiles, const char *partitionLabel)
+{
+    if (hostFsRoot.empty())
+    {
+        char directory[] = "/tmp/spiffsXXXXXX";
+        if (mkdtemp(directory) == NULL)
+        {
+            return false;
+        }
+        hostFsRoot = directory;
+    }
+    struct stat info;
+    if (stat(hostFsRoot.c_str(), &info) != 0 || !S_ISDIR(info.st_mode))
+    {
+        return false;
+    }
+    root = hostFsRoot;
+    return true;
+}
+
+void SPIFFSFS::end()
+{
+    root.clear();
+}
+
+bool SPIFFSFS::format()
+{
+    if (root.empty())
+    {
+        return false;
+    }
+    std::vector<std::string> names = HostFs_list(root);
+    for (size_t i = 0; i < names.size(); i++)
+    {
+        ::remove(HostFs_escape(root, names[i]).c_str());
+    }
+    return true;
+}
+
+size_t SPIFFSFS::totalBytes()
+{
+    return hostFsTotalBytes;
+}
+
+size_t SPIFFSFS::usedBytes()
+{
+    size_t used = 0;
+    std::vector<std::string> names = HostFs_list(root);
+    for (size_t i = 0; i < names.size(); i++)
+    {
+        struct stat info;
+        if (stat(HostFs_escape(root, names[i]).c_str(), &info) == 0)
+        {
+            used += info.st_size;
+        }
+    }
+    return used;
+}
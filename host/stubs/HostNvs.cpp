@@ -0,0 +1,332 @@
+#include <nvs.h>
+#include <nvs_flash.h>
+#include <Preferences.h>
+#include <string.h>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+enum HostNvsType {
+    HOST_NVS_I32,
+    HOST_NVS_U32,
+    HOST_NVS_STR,
+    HOST_NVS_BLOB,
+};
+
+/**
+ * HostNvsValue
+ * One key, strings are stored with their terminator
+ */
+struct HostNvsValue {
+    HostNvsType type;
+    std::vector<uint8_t> data;
+};
+
+/**
+ * HostNvsHandle
+ * Namespace and mode of an open handle
+ */
+struct HostNvsHandle {
+    std::string name;
+    bool readOnly;
+};
+
+typedef std::map<std::string, HostNvsValue> HostNvsNamespace;
+
+static std::mutex nvsMutex;
+static std::map<std::string, HostNvsNamespace> nvsNamespaces;
+static std::map<nvs_handle_t, HostNvsHandle> nvsHandles;
+static nvs_handle_t nvsNextHandle = 1;
+
+esp_err_t nvs_flash_init()
+{
+    return ESP_OK;
+}
+
+esp_err_t nvs_flash_erase()
+{
+    std::lock_guard<std::mutex> lock(nvsMutex);
+    nvsNamespaces.clear();
+    return ESP_OK;
+}
+
+esp_err_t nvs_open(const char *name, nvs_open_mode_t mode, nvs_handle_t *handle)
+{
+    std::lock_guard<std::mutex> lock(nvsMutex);
+    if (mode == NVS_READONLY && nvsNamespaces.count(name) == 0)
+    {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    nvsNamespaces[name];
+    *handle = nvsNextHandle++;
+    nvsHandles[*handle] = HostNvsHandle{ name, mode == NVS_READONLY };
+    return ESP_OK;
+}
+
+void nvs_close(nvs_handle_t handle)
+{
+    std::lock_guard<std::mutex> lock(nvsMutex);
+    nvsHandles.erase(handle);
+}
+
+/** Namespace of handle, NULL with err set if the handle is not open or not writable */
+static HostNvsNamespace *HostNvs_find(nvs_handle_t handle, bool write, esp_err_t *err)
+{
+    std::map<nvs_handle_t, HostNvsHandle>::iterator h = nvsHandles.find(handle);
+    if (h == nvsHandles.end())
+    {
+        *err = ESP_ERR_NVS_INVALID_HANDLE;
+        return NULL;
+    }
+    if (write && h->second.readOnly)
+    {
+        *err = ESP_ERR_NVS_READ_ONLY;
+        return NULL;
+    }
+    *err = ESP_OK;
+    return &nvsNamespaces[h->second.name];
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle)
+{
+    std::lock_guard<std::mutex> lock(nvsMutex);
+    esp_err_t err;
+    HostNvs_find(handle, false, &err);
+    return err;
+}
+
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char *key)
+{
+    std::lock_guard<std::mutex> lock(nvsMutex);
+    esp_err_t err;
+    HostNvsNamespace *space = HostNvs_find(handle, true, &err);
+    if (space == NULL)
+    {
+        return err;
+    }
+    return space->erase(key) > 0 ? ESP_OK : ESP_ERR_NVS_NOT_FOUND;
+}
+
+esp_err_t nvs_erase_all(nvs_handle_t handle)
+{
+    std::lock_guard<std::mutex> lock(nvsMutex);
+    esp_err_t err;
+    HostNvsNamespace *space = HostNvs_find(handle, true, &err);
+    if (space != NULL)
+    {
+        space->clear();
+    }
+    return err;
+}
+
+static esp_err_t HostNvs_set(nvs_handle_t handle, const char *key, HostNvsType type, const void *value, size_t length)
+{
+    std::lock_guard<std::mutex> lock(nvsMutex);
+    esp_err_t err;
+    HostNvsNamespace *space = HostNvs_find(handle, true, &err);
+    if (space == NULL)
+    {
+        return err;
+    }
+    if (strlen(key) > 15)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    const uint8_t *data = (const uint8_t *)value;
+    (*space)[key] = HostNvsValue{ type, std::vector<uint8_t>(data, data + length) };
+    return ESP_OK;
+}
+
+/** Copies the value into value if it is not NULL and fits, length is the stored length */
+static esp_err_t HostNvs_get(nvs_handle_t handle, const char *key, HostNvsType type, void *value, size_t *length)
+{
+    std::lock_guard<std::mutex> lock(nvsMutex);
+    esp_err_t err;
+    HostNvsNamespace *space = HostNvs_find(handle, false, &err);
+    if (space == NULL)
+    {
+        return err;
+    }
+    HostNvsNamespace::iterator entry = space->find(key);
+    if (entry == space->end() || entry->second.type != type)
+    {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    size_t stored = entry->second.data.size();
+    if (value != NULL)
+    {
+        if (*length < stored)
+        {
+            return ESP_ERR_NVS_INVALID_LENGTH;
+        }
+        memcpy(value, entry->second.data.data(), stored);
+    }
+    *length = stored;
+    return ESP_OK;
+}
+
+esp_err_t nvs_set_i32(nvs_handle_t handle, const char *key, int32_t value)
+{
+    return HostNvs_set(handle, key, HOST_NVS_I32, &value, sizeof(value));
+}
+
+esp_err_t nvs_set_u32(nvs_handle_t handle, const char *key, uint32_t value)
+{
+    return HostNvs_set(handle, key, HOST_NVS_U32, &value, sizeof(value));
+}
+
+esp_err_t nvs_set_str(nvs_handle_t handle, const char *key, const char *value)
+{
+    return HostNvs_set(handle, key, HOST_NVS_STR, value, strlen(value) + 1);
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *value, size_t length)
+{
+    return HostNvs_set(handle, key, HOST_NVS_BLOB, value, length);
+}
+
+esp_err_t nvs_get_i32(nvs_handle_t handle, const char *key, int32_t *value)
+{
+    size_t length = sizeof(*value);
+    return HostNvs_get(handle, key, HOST_NVS_I32, value, &length);
+}
+
+esp_err_t nvs_get_u32(nvs_handle_t handle, const char *key, uint32_t *value)
+{
+    size_t length = sizeof(*value);
+    return HostNvs_get(handle, key, HOST_NVS_U32, value, &length);
+}
+
+esp_err_t nvs_get_str(nvs_handle_t handle, const char *key, char *value, size_t *length)
+{
+    return HostNvs_get(handle, key, HOST_NVS_STR, value, length);
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *value, size_t *length)
+{
+    return HostNvs_get(handle, key, HOST_NVS_BLOB, value, length);
+}
+
+bool Preferences::begin(const char *name, bool readOnly)
+{
+    if (started)
+    {
+        return false;
+    }
+    this->readOnly = readOnly;
+    started = nvs_open(name, readOnly ? NVS_READONLY : NVS_READWRITE, &handle) == ESP_OK;
+    return started;
+}
+
+void Preferences::end()
+{
+    if (started)
+    {
+        nvs_close(handle);
+        started = false;
+    }
+}
+
+bool Preferences::clear()
+{
+    return started && !readOnly && nvs_erase_all(handle) == ESP_OK && nvs_commit(handle) == ESP_OK;
+}
+
+bool Preferences::remove(const char *key)
+{
+    return started && !readOnly && nvs_erase_key(handle, key) == ESP_OK && nvs_commit(handle) == ESP_OK;
+}
+
+bool Preferences::isKey(const char *key)
+{
+    int32_t i;
+    uint32_t u;
+    size_t length;
+    return started && (nvs_get_i32(handle, key, &i) == ESP_OK || nvs_get_u32(handle, key, &u) == ESP_OK ||
+        nvs_get_str(handle, key, NULL, &length) == ESP_OK || nvs_get_blob(handle, key, NULL, &length) == ESP_OK);
+}
+
+size_t Preferences::putInt(const char *key, int32_t value)
+{
+    if (!started || readOnly || nvs_set_i32(handle, key, value) != ESP_OK || nvs_commit(handle) != ESP_OK)
+    {
+        return 0;
+    }
+    return sizeof(value);
+}
+
+size_t Preferences::putUInt(const char *key, uint32_t value)
+{
+    if (!started || readOnly || nvs_set_u32(handle, key, value) != ESP_OK || nvs_commit(handle) != ESP_OK)
+    {
+        return 0;
+    }
+    return sizeof(value);
+}
+
+size_t Preferences::putString(const char *key, const char *value)
+{
+    if (!started || readOnly || nvs_set_str(handle, key, value) != ESP_OK || nvs_commit(handle) != ESP_OK)
+    {
+        return 0;
+    }
+    return strlen(value);
+}
+
+size_t Preferences::putBytes(const char *key, const void *value, size_t length)
+{
+    if (!started || readOnly || nvs_set_blob(handle, key, value, length) != ESP_OK || nvs_commit(handle) != ESP_OK)
+    {
+        return 0;
+    }
+    return length;
+}
+
+int32_t Preferences::getInt(const char *key, int32_t defaultValue)
+{
+    int32_t value = defaultValue;
+    if (started)
+    {
+        nvs_get_i32(handle, key, &value);
+    }
+    return value;
+}
+
+uint32_t Preferences::getUInt(const char *key, uint32_t defaultValue)
+{
+    uint32_t value = defaultValue;
+    if (started)
+    {
+        nvs_get_u32(handle, key, &value);
+    }
+    return value;
+}
+
+size_t Preferences::getString(const char *key, char *value, size_t maxLength)
+{
+    size_t length = 0;
+    if (!started || nvs_get_str(handle, key, NULL, &length) != ESP_OK || length > maxLength)
+    {
+        return 0;
+    }
+    if (nvs_get_str(handle, key, value, &length) != ESP_OK)
+    {
+        return 0;
+    }
+    return length;
+}
+
+size_t Preferences::getBytes(const char *key, void *value, size_t maxLength)
+{
+    size_t length = 0;
+    if (!started || nvs_get_blob(handle, key, NULL, &length) != ESP_OK || length > maxLength)
+    {
+        return 0;
+    }
+    if (nvs_get_blob(handle, key, value, &length) != ESP_OK)
+    {
+        return 0;
+    }
+    return length;
+}
@@ -0,0 +1,219 @@
+#include <Arduino.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * HostTask
+ * Notification count of one thread that runs a task or called a FreeRTOS function
+ */
+struct HostTask {
+    uint32_t notifications;
+};
+
+/**
+ * HostQueue
+ * Items of a queue, a binary semaphore is a queue of one empty item
+ */
+struct HostQueue {
+    size_t length;
+    size_t itemSize;
+    std::deque<std::vector<uint8_t>> items;
+};
+
+static std::mutex rtosMutex;
+static std::condition_variable rtosChanged;
+static std::recursive_mutex criticalMutex;
+static thread_local HostTask *currentTask = NULL;
+
+static const std::chrono::steady_clock::time_point clockStart = std::chrono::steady_clock::now();
+static std::atomic<uint64_t> clockOffsetUs(0);
+
+static uint64_t HostClock_us()
+{
+    std::chrono::steady_clock::duration elapsed = std::chrono::steady_clock::now() - clockStart;
+    return std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count() + clockOffsetUs.load();
+}
+
+unsigned long millis()
+{
+    return (uint32_t)(HostClock_us() / 1000);
+}
+
+unsigned long micros()
+{
+    return (uint32_t)HostClock_us();
+}
+
+void HostClock_advance(uint32_t ms)
+{
+    {
+        std::lock_guard<std::mutex> lock(rtosMutex);
+        clockOffsetUs += (uint64_t)ms * 1000;
+    }
+    rtosChanged.notify_all();
+}
+
+/**
+ * Wait until ready() holds or ticks passed on the HostClock.
+ * Returns false on a timeout.
+ */
+template <class Ready>
+static bool HostRtos_wait(std::unique_lock<std::mutex> &lock, TickType_t ticks, Ready ready)
+{
+    if (ticks == portMAX_DELAY)
+    {
+        rtosChanged.wait(lock, ready);
+        return true;
+    }
+    uint64_t deadline = HostClock_us() + (uint64_t)ticks * 1000;
+    while (!ready())
+    {
+        uint64_t now = HostClock_us();
+        if (now >= deadline)
+        {
+            return false;
+        }
+        rtosChanged.wait_for(lock, std::chrono::microseconds(deadline - now));
+    }
+    return true;
+}
+
+void delay(uint32_t ms)
+{
+    vTaskDelay(pdMS_TO_TICKS(ms));
+}
+
+BaseType_t xTaskCreate(TaskFunction_t function, const char *name, uint32_t stackDepth,
+    void *parameter, UBaseType_t priority, TaskHandle_t *handle)
+{
+    HostTask *task = new HostTask();
+    task->notifications = 0;
+    if (handle != NULL)
+    {
+        *handle = task;
+    }
+    std::thread([=]() {
+        currentTask = task;
+        function(parameter);
+    }).detach();
+    return pdPASS;
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle()
+{
+    if (currentTask == NULL)
+    {
+        // a thread the stand-in did not start, e.g. the one of main()
+        currentTask = new HostTask();
+        currentTask->notifications = 0;
+    }
+    return currentTask;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    {
+        std::lock_guard<std::mutex> lock(rtosMutex);
+        task->notifications++;
+    }
+    rtosChanged.notify_all();
+    return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clearOnExit, TickType_t ticks)
+{
+    HostTask *task = xTaskGetCurrentTaskHandle();
+    std::unique_lock<std::mutex> lock(rtosMutex);
+    HostRtos_wait(lock, ticks, [task]() { return task->notifications > 0; });
+    uint32_t count = task->notifications;
+    if (count > 0)
+    {
+        task->notifications = clearOnExit ? 0 : count - 1;
+    }
+    return count;
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    std::unique_lock<std::mutex> lock(rtosMutex);
+    HostRtos_wait(lock, ticks, []() { return false; });
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize)
+{
+    HostQueue *queue = new HostQueue();
+    queue->length = length;
+    queue->itemSize = itemSize;
+    return queue;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks)
+{
+    {
+        std::unique_lock<std::mutex> lock(rtosMutex);
+        if (!HostRtos_wait(lock, ticks, [queue]() { return queue->items.size() < queue->length; }))
+        {
+            return pdFALSE;
+        }
+        const uint8_t *data = (const uint8_t *)item;
+        queue->items.push_back(std::vector<uint8_t>(data, data + queue->itemSize));
+    }
+    rtosChanged.notify_all();
+    return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticks)
+{
+    {
+        std::unique_lock<std::mutex> lock(rtosMutex);
+        if (!HostRtos_wait(lock, ticks, [queue]() { return !queue->items.empty(); }))
+        {
+            return pdFALSE;
+        }
+        if (queue->itemSize > 0)
+        {
+            memcpy(item, queue->items.front().data(), queue->itemSize);
+        }
+        queue->items.pop_front();
+    }
+    rtosChanged.notify_all();
+    return pdTRUE;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue)
+{
+    std::lock_guard<std::mutex> lock(rtosMutex);
+    return queue->items.size();
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary()
+{
+    return xQueueCreate(1, 0);
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore)
+{
+    return xQueueSend(semaphore, NULL, 0);
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks)
+{
+    return xQueueReceive(semaphore, NULL, ticks);
+}
+
+void vPortEnterCritical(portMUX_TYPE *mux)
+{
+    criticalMutex.lock();
+    mux->count++;
+}
+
+void vPortExitCritical(portMUX_TYPE *mux)
+{
+    mux->count--;
+    criticalMutex.unlock();
+}
@@ -0,0 +1,35 @@
+// Preferences stand-in for host builds, on top of the NVS stand-in like the real one
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include "nvs.h"
+
+class Preferences
+{
+public:
+	Preferences() : handle(0), started(false), readOnly(false) {}
+	~Preferences() { end(); }
+
+	bool begin(const char *name, bool readOnly = false);
+	void end();
+	bool clear();
+	bool remove(const char *key);
+	bool isKey(const char *key);
+
+	size_t putInt(const char *key, int32_t value);
+	size_t putUInt(const char *key, uint32_t value);
+	size_t putString(const char *key, const char *value);
+	size_t putBytes(const char *key, const void *value, size_t length);
+
+	int32_t getInt(const char *key, int32_t defaultValue = 0);
+	uint32_t getUInt(const char *key, uint32_t defaultValue = 0);
+	/** Length of the value with its terminator, 0 if missing or longer than maxLength */
+	size_t getString(const char *key, char *value, size_t maxLength);
+	/** Length of the value, 0 if missing or longer than maxLength */
+	size_t getBytes(const char *key, void *value, size_t maxLength);
+
+private:
+	nvs_handle_t handle;
+	bool started;
+	bool readOnly;
+};
@@ -0,0 +1,21 @@
+// SPIFFS stand-in for host builds, see FS.h
+#pragma once
+#include "FS.h"
+
+class SPIFFSFS : public fs::FS
+{
+public:
+	bool begin(bool formatOnFail = false, const char *basePath = "/spiffs", uint8_t maxOpenFiles = 10, const char *partitionLabel = NULL);
+	void end();
+	bool format();
+	/** 49196 by default, what the spiffs partition of custompart.csv reports */
+	size_t totalBytes();
+	size_t usedBytes();
+};
+
+extern SPIFFSFS SPIFFS;
+
+/** Directory SPIFFS.begin() mounts, a new temporary one if none is set */
+void HostFs_setRoot(const char *directory);
+const char *HostFs_getRoot();
+void HostFs_setTotalBytes(size_t bytes);
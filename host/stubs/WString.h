@@ -0,0 +1,130 @@
+// Arduino String stand-in for host builds, the subset this project uses
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+
+class String
+{
+public:
+	String(const char *s = "") : text(s != NULL ? s : "") {}
+	String(const std::string &s) : text(s) {}
+	explicit String(char c) : text(1, c) {}
+	explicit String(int value) : text(std::to_string(value)) {}
+	explicit String(unsigned int value) : text(std::to_string(value)) {}
+	explicit String(long value) : text(std::to_string(value)) {}
+	explicit String(unsigned long value) : text(std::to_string(value)) {}
+
+	String &operator=(const char *s)
+	{
+		text = s != NULL ? s : "";
+		return *this;
+	}
+
+	String &operator+=(const String &s)
+	{
+		text += s.text;
+		return *this;
+	}
+
+	String &operator+=(const char *s)
+	{
+		text += s;
+		return *this;
+	}
+
+	String &operator+=(char c)
+	{
+		text += c;
+		return *this;
+	}
+
+	bool concat(const char *s)
+	{
+		text += s;
+		return true;
+	}
+
+	bool concat(char c)
+	{
+		text += c;
+		return true;
+	}
+
+	void reserve(size_t size)
+	{
+		text.reserve(size);
+	}
+
+	const char *c_str() const
+	{
+		return text.c_str();
+	}
+
+	unsigned int length() const
+	{
+		return text.length();
+	}
+
+	char &operator[](unsigned int index)
+	{
+		return text[index];
+	}
+
+	char operator[](unsigned int index) const
+	{
+		return text[index];
+	}
+
+	bool operator==(const String &s) const
+	{
+		return text == s.text;
+	}
+
+	bool operator==(const char *s) const
+	{
+		return text == s;
+	}
+
+	bool operator!=(const String &s) const
+	{
+		return text != s.text;
+	}
+
+	bool operator!=(const char *s) const
+	{
+		return text != s;
+	}
+
+private:
+	std::string text;
+};
+
+/** Result of a concatenation, lets "text" + string work like on Arduino */
+class StringSumHelper : public String
+{
+public:
+	StringSumHelper(const String &s) : String(s) {}
+	StringSumHelper(const char *s) : String(s) {}
+};
+
+inline StringSumHelper operator+(const StringSumHelper &lhs, const String &rhs)
+{
+	StringSumHelper sum(lhs);
+	sum += rhs;
+	return sum;
+}
+
+inline StringSumHelper operator+(const StringSumHelper &lhs, const char *rhs)
+{
+	StringSumHelper sum(lhs);
+	sum += rhs;
+	return sum;
+}
+
+inline StringSumHelper operator+(const StringSumHelper &lhs, int rhs)
+{
+	StringSumHelper sum(lhs);
+	sum += String(rhs);
+	return sum;
+}
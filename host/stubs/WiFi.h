@@ -0,0 +1,37 @@
+// WiFi stand-in for host builds, finds no networks and never connects
+#pragma once
+#include <Arduino.h>
+
+typedef enum {
+	ARDUINO_EVENT_WIFI_STA_CONNECTED,
+	ARDUINO_EVENT_WIFI_STA_DISCONNECTED,
+	ARDUINO_EVENT_WIFI_STA_GOT_IP,
+	ARDUINO_EVENT_WIFI_STA_LOST_IP,
+} arduino_event_id_t;
+
+typedef enum {
+	WIFI_OFF,
+	WIFI_STA,
+	WIFI_AP,
+	WIFI_AP_STA,
+} wifi_mode_t;
+
+typedef void (*WiFiEventCb)(arduino_event_id_t event);
+
+class WiFiClass
+{
+public:
+	bool disconnect(bool wifioff = false) { return true; }
+	bool enableSTA(bool enable) { return true; }
+	bool mode(wifi_mode_t mode) { return true; }
+	int16_t scanNetworks(bool async = false, bool showHidden = false, bool passive = false, uint32_t maxMsPerChannel = 300) { return 0; }
+	String SSID(uint8_t index) { return String(); }
+	String SSID() { return String(); }
+	int32_t RSSI(uint8_t index) { return 0; }
+	int8_t RSSI() { return 0; }
+	String localIP() { return String("0.0.0.0"); }
+	int begin(const char *ssid, const char *passphrase) { return 0; }
+	int onEvent(WiFiEventCb callback, arduino_event_id_t event) { return 0; }
+};
+
+extern WiFiClass WiFi;
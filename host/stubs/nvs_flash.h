@@ -0,0 +1,6 @@
+// NVS partition stand-in for host builds, erase forgets every namespace
+#pragma once
+#include "esp_err.h"
+
+esp_err_t nvs_flash_init();
+esp_err_t nvs_flash_erase();
@@ -0,0 +1,77 @@
+// Two threads move 50 MB through ByteRingBuffer, one pushing and one
+// popping in pieces of changing size, and the bytes must come out in order.
+#include "ByteRingBuffer.h"
+#include "Bench.h"
+#include <stdio.h>
+#include <random>
+#include <thread>
+
+#define TEST_RING_BYTES (50u * 1000 * 1000)
+
+static ByteRingBuffer<4096> ring;
+
+/** Byte at a stream position, not periodic within the ring size */
+static uint8_t pattern(uint32_t position)
+{
+	return (uint8_t)(position ^ (position >> 8) ^ (position >> 16) * 31);
+}
+
+static void produce()
+{
+	std::mt19937 random(1);
+	uint8_t piece[600];
+	uint32_t position = 0;
+	while (position < TEST_RING_BYTES) {
+		size_t length = random() % sizeof(piece) + 1;
+		if (length > TEST_RING_BYTES - position)
+			length = TEST_RING_BYTES - position;
+		for (size_t i = 0; i < length; i++)
+			piece[i] = pattern(position + i);
+		size_t done = 0;
+		while (done < length) {
+			// single bytes now and then, like BleSerial_write(uint8_t)
+			size_t stored = length - done == 1 ? ring.add(piece[done]) : ring.push(&piece[done], length - done);
+			if (stored == 0)
+				std::this_thread::yield();
+			done += stored;
+		}
+		position += length;
+	}
+}
+
+int main()
+{
+	double start = Bench_now();
+	std::thread producer(produce);
+	std::mt19937 random(2);
+	uint8_t piece[600];
+	uint32_t position = 0;
+	uint32_t errors = 0;
+	while (position < TEST_RING_BYTES) {
+		size_t wanted = random() % sizeof(piece) + 1;
+		// single bytes now and then, like BleSerial_read()
+		size_t length = 0;
+		if (wanted == 1 && ring.getLength() > 0)
+			piece[length++] = ring.pop();
+		else if (wanted > 1)
+			length = ring.pop(piece, wanted);
+		if (length == 0) {
+			std::this_thread::yield();
+			continue;
+		}
+		if (ring.getLength() > ring.getCapacity())
+			errors++;
+		for (size_t i = 0; i < length; i++) {
+			if (piece[i] != pattern(position + i) && errors++ < 10)
+				fprintf(stderr, "byte %u is %u, expected %u\n", position + i, piece[i], pattern(position + i));
+		}
+		position += length;
+	}
+	producer.join();
+	if (ring.getLength() != 0)
+		errors++;
+	double us = Bench_now() - start;
+	printf("ring: %u bytes through two threads in %.0f ms, %.1f MB/s, %u errors\n",
+		position, us / 1000, Bench_mbps(position, us), errors);
+	return errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,68 @@
+#include "BleCommand.h"
+
+#define BLE_COMMAND_TABLE_SIZE 32 // power of two, well above the number of commands
+
+/**
+ * BleCommandEntry
+ * Slot of the open addressing table, key 0 marks a free slot
+ */
+typedef struct BleCommandEntry {
+    uint32_t key;
+    BleCommandHandler handler;
+    BleStatHistogram histogram; // where the run times of the handler go
+} BleCommandEntry;
+
+static BleCommandEntry commandTable[BLE_COMMAND_TABLE_SIZE];
+
+/**
+ * Add a handler for a command key, its run times are recorded in histogram.
+ * Fails if the key is already taken or the table is full.
+ */
+bool BleCommand_register(uint32_t key, BleCommandHandler handler, BleStatHistogram histogram)
+{
+    if (key == 0 || handler == NULL)
+    {
+        return false;
+    }
+    for (size_t i = 0; i < BLE_COMMAND_TABLE_SIZE; i++)
+    {
+        BleCommandEntry *entry = &commandTable[(key + i) & (BLE_COMMAND_TABLE_SIZE - 1)];
+        if (entry->key == key)
+        {
+            return false;
+        }
+        if (entry->key == 0)
+        {
+            entry->key = key;
+            entry->handler = handler;
+            entry->histogram = histogram;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Find the handler of a command key, NULL if there is none.
+ * histogram, if given, is set to the histogram of the handler.
+ */
+BleCommandHandler BleCommand_find(uint32_t key, BleStatHistogram *histogram)
+{
+    for (size_t i = 0; i < BLE_COMMAND_TABLE_SIZE; i++)
+    {
+        const BleCommandEntry *entry = &commandTable[(key + i) & (BLE_COMMAND_TABLE_SIZE - 1)];
+        if (entry->key == key)
+        {
+            if (histogram != NULL)
+            {
+                *histogram = entry->histogram;
+            }
+            return entry->handler;
+        }
+        if (entry->key == 0)
+        {
+            return NULL;
+        }
+    }
+    return NULL;
+}
@@ -0,0 +1,35 @@
+#ifndef BLECOMMAND_H
+#define BLECOMMAND_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <type_traits>
+#include "BleStats.h"
+
+struct BleRequest;
+
+/** Handles one request, called once per request by ReadBLESerialTask */
+typedef void (*BleCommandHandler)(struct BleRequest *request);
+
+/** FNV-1a hash, usable in constant expressions */
+constexpr uint32_t BleCommand_hash(const char *s, uint32_t h = 2166136261u)
+{
+    return *s ? BleCommand_hash(s + 1, (h ^ (uint8_t)*s) * 16777619u) : h;
+}
+
+/** Key of a command, e.g. BleCommand_key("read", "config_count") */
+constexpr uint32_t BleCommand_key(const char *verb, const char *name)
+{
+    return BleCommand_hash(name, BleCommand_hash(":", BleCommand_hash(verb)));
+}
+
+/** Hash of a literal, guaranteed to be computed by the compiler */
+#define BLE_HASH(s) (std::integral_constant<uint32_t, BleCommand_hash(s)>::value)
+
+/** Key of a command, guaranteed to be computed by the compiler */
+#define BLE_COMMAND(verb, name) (std::integral_constant<uint32_t, BleCommand_key(verb, name)>::value)
+
+bool BleCommand_register(uint32_t key, BleCommandHandler handler, BleStatHistogram histogram = BLE_HIST_HANDLER_OTHER);
+BleCommandHandler BleCommand_find(uint32_t key, BleStatHistogram *histogram = NULL);
+
+#endif // BLECOMMAND_H
@@ -0,0 +1,109 @@
+// Framing of the BLE serial command channel
+//
+// A frame is a 5 byte header followed by the payload:
+//   magic (0xA5), type, sequence, length (little endian, 2 bytes)
+// The header is sent as is, the payload is XOR encoded like before.
+// A client that sends no magic byte is served unframed as before.
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+#define BLE_FRAME_MAGIC 0xA5
+#define BLE_FRAME_HEADER_SIZE 5
+
+enum BleFrameType {
+	BLE_FRAME_JSON = 1,
+	// payload: offset (4 bytes), CRC32 of the data (4 bytes), data, all little endian
+	BLE_FRAME_FILE_CHUNK = 2,
+	// payload: a MessagePack map with the keys of the JSON request or reply
+	BLE_FRAME_MSGPACK = 3,
+};
+
+#define BLE_FRAME_CHUNK_HEADER_SIZE 8
+
+typedef struct BleFrameHeader {
+	uint8_t type;
+	uint8_t sequence;
+	uint16_t length;
+} BleFrameHeader;
+
+inline void BleFrame_encodeHeader(uint8_t *out, const BleFrameHeader &header)
+{
+	out[0] = BLE_FRAME_MAGIC;
+	out[1] = header.type;
+	out[2] = header.sequence;
+	out[3] = header.length & 0xFF;
+	out[4] = header.length >> 8;
+}
+
+/**
+ * BleFrameDecoder
+ * Reassembles the header of a frame from a byte stream that arrives in pieces.
+ * The caller reads at most wanted() bytes into next() and reports them with
+ * commit(), so no byte of the payload is taken from the receive buffer.
+ * The payload is then read straight from the receive buffer by the caller,
+ * which calls reset() once it has consumed header.length bytes.
+ */
+class BleFrameDecoder
+{
+public:
+	BleFrameDecoder()
+	{
+		reset();
+	}
+
+	void reset()
+	{
+		count = 0;
+	}
+
+	// true while no byte of a frame has been consumed
+	bool isIdle() const
+	{
+		return count == 0;
+	}
+
+	// number of header bytes still missing
+	size_t wanted() const
+	{
+		return BLE_FRAME_HEADER_SIZE - count;
+	}
+
+	// where the next wanted() bytes go
+	uint8_t *next()
+	{
+		return &raw[count];
+	}
+
+	// consume length bytes written to next(), true once the header is complete
+	bool commit(size_t length)
+	{
+		count += length;
+		if (count < BLE_FRAME_HEADER_SIZE)
+			return false;
+		if (raw[0] != BLE_FRAME_MAGIC) {
+			reset();
+			return false;
+		}
+		header.type = raw[1];
+		header.sequence = raw[2];
+		header.length = raw[3] | (raw[4] << 8);
+		return true;
+	}
+
+	// true once commit() reported a complete header and until reset()
+	bool hasHeader() const
+	{
+		return count >= BLE_FRAME_HEADER_SIZE;
+	}
+
+	const BleFrameHeader &getHeader() const
+	{
+		return header;
+	}
+
+private:
+	size_t count;
+	uint8_t raw[BLE_FRAME_HEADER_SIZE];
+	BleFrameHeader header;
+};
@@ -0,0 +1,131 @@
+#include <Arduino.h>
+#include <stdarg.h>
+#include "BleLog.h"
+
+/**
+ * BleLogRecord
+ * A message as queued, formatted only by the log task
+ */
+typedef struct BleLogRecord {
+    uint32_t time; // ms since boot
+    uint8_t level;
+    const char *tag;
+    const char *format;
+    uintptr_t args[BLE_LOG_MAX_ARGS];
+    int8_t textArg; // index of the argument copied into text, -1 if none
+    char text[BLE_LOG_TEXT_SIZE];
+} BleLogRecord;
+
+static QueueHandle_t logQueue = NULL;
+static volatile uint32_t logDropped = 0;
+static const char logLevelChar[] = "-EWIDV";
+
+/**
+ * Index of the argument of the first %s in format, -1 if there is none.
+ * Only counts conversions, flags and width of a conversion are skipped.
+ */
+static int BleLog_findStringArg(const char *format)
+{
+    int index = 0;
+    for (const char *c = format; *c; c++)
+    {
+        if (*c != '%')
+        {
+            continue;
+        }
+        c++;
+        if (*c == '%')
+        {
+            continue;
+        }
+        while (*c && strchr("-+ #0123456789.lhzjt", *c) != NULL)
+        {
+            c++;
+        }
+        if (*c == 's')
+        {
+            return index;
+        }
+        if (*c == '\0')
+        {
+            break;
+        }
+        index++;
+    }
+    return -1;
+}
+
+static void BleLog_print(BleLogRecord *record)
+{
+    uintptr_t a[BLE_LOG_MAX_ARGS];
+    memcpy(a, record->args, sizeof(a));
+    if (record->textArg >= 0)
+    {
+        a[record->textArg] = (uintptr_t)record->text;
+    }
+    // every argument was stored as a word, 32 bits is what the ESP32 passes
+    char line[128];
+    snprintf(line, sizeof(line), record->format, a[0], a[1], a[2], a[3]);
+    Serial.printf("[%6u][%c][%s] %s\r\n", record->time, logLevelChar[record->level], record->tag, line);
+}
+
+static void BleLog_task(void *parameter)
+{
+    BleLogRecord record;
+    while (true)
+    {
+        if (xQueueReceive(logQueue, &record, portMAX_DELAY) == pdTRUE)
+        {
+            BleLog_print(&record);
+        }
+    }
+}
+
+void BleLog_init()
+{
+    logQueue = xQueueCreate(BLE_LOG_QUEUE_LENGTH, sizeof(BleLogRecord));
+    // below the BLE tasks, only runs when they wait
+    xTaskCreate(BleLog_task, "BleLogTask", 3072, NULL, tskIDLE_PRIORITY, NULL);
+}
+
+void BleLog_write(uint8_t level, const char *tag, const char *format, ...)
+{
+    BleLogRecord record;
+    record.time = millis();
+    record.level = level;
+    record.tag = tag;
+    record.format = format;
+    va_list list;
+    va_start(list, format);
+    for (int i = 0; i < BLE_LOG_MAX_ARGS; i++)
+    {
+        record.args[i] = va_arg(list, uintptr_t);
+    }
+    va_end(list);
+    record.textArg = BleLog_findStringArg(format);
+    if (record.textArg >= BLE_LOG_MAX_ARGS)
+    {
+        record.textArg = -1;
+    }
+    if (record.textArg >= 0)
+    {
+        const char *text = (const char *)record.args[record.textArg];
+        strncpy(record.text, text != NULL ? text : "(null)", sizeof(record.text) - 1);
+        record.text[sizeof(record.text) - 1] = '\0';
+    }
+
+    if (logQueue == NULL)
+    {
+        BleLog_print(&record);
+        return;
+    }
+    if (xQueueSend(logQueue, &record, 0) != pdTRUE)
+    {
+        logDropped++;
+    }
+}
+
+uint32_t BleLog_dropped()
+{
+    return logDropped;
+}
@@ -0,0 +1,75 @@
+// Leveled logger that keeps Serial output off the transfer task
+//
+// BLE_LOGE/W/I/D/V(tag, format, ...) store the format, the tag and up to
+// BLE_LOG_MAX_ARGS word sized arguments in a queue without formatting.
+// A low priority task formats and prints them later, so a call costs a
+// queue send instead of milliseconds of 115200 baud output.
+// Calls above BLE_LOG_LEVEL (or BLE_LOG_LOCAL_LEVEL of a file, defined
+// before the include) are removed by the preprocessor.
+//
+// format and tag must be string literals. Arguments are integers, chars or
+// pointers; the first %s is copied when the call is made (up to
+// BLE_LOG_TEXT_SIZE - 1 characters), any further %s must outlive the message.
+// Floating point arguments are not supported.
+#pragma once
+#include <stdint.h>
+
+#define BLE_LOG_LEVEL_NONE 0
+#define BLE_LOG_LEVEL_ERROR 1
+#define BLE_LOG_LEVEL_WARN 2
+#define BLE_LOG_LEVEL_INFO 3
+#define BLE_LOG_LEVEL_DEBUG 4
+#define BLE_LOG_LEVEL_VERBOSE 5
+
+#ifndef BLE_LOG_LEVEL
+#define BLE_LOG_LEVEL BLE_LOG_LEVEL_INFO
+#endif
+
+#ifndef BLE_LOG_LOCAL_LEVEL
+#define BLE_LOG_LOCAL_LEVEL BLE_LOG_LEVEL
+#endif
+
+#define BLE_LOG_MAX_ARGS 4
+#define BLE_LOG_TEXT_SIZE 48
+#define BLE_LOG_QUEUE_LENGTH 16
+
+/** Create the queue and the task that prints it, messages before are printed at once */
+void BleLog_init();
+/** Queue a message, use the BLE_LOG macros instead */
+void BleLog_write(uint8_t level, const char *tag, const char *format, ...);
+/** Messages lost because the queue was full */
+uint32_t BleLog_dropped();
+
+// the trailing zeros make BleLog_write always find BLE_LOG_MAX_ARGS arguments
+#define BLE_LOG_AT(level, tag, format, ...) BleLog_write(level, tag, format, ##__VA_ARGS__, 0, 0, 0, 0)
+#define BLE_LOG_NOTHING() do {} while (0)
+
+#if BLE_LOG_LOCAL_LEVEL >= BLE_LOG_LEVEL_ERROR
+#define BLE_LOGE(tag, format, ...) BLE_LOG_AT(BLE_LOG_LEVEL_ERROR, tag, format, ##__VA_ARGS__)
+#else
+#define BLE_LOGE(tag, format, ...) BLE_LOG_NOTHING()
+#endif
+
+#if BLE_LOG_LOCAL_LEVEL >= BLE_LOG_LEVEL_WARN
+#define BLE_LOGW(tag, format, ...) BLE_LOG_AT(BLE_LOG_LEVEL_WARN, tag, format, ##__VA_ARGS__)
+#else
+#define BLE_LOGW(tag, format, ...) BLE_LOG_NOTHING()
+#endif
+
+#if BLE_LOG_LOCAL_LEVEL >= BLE_LOG_LEVEL_INFO
+#define BLE_LOGI(tag, format, ...) BLE_LOG_AT(BLE_LOG_LEVEL_INFO, tag, format, ##__VA_ARGS__)
+#else
+#define BLE_LOGI(tag, format, ...) BLE_LOG_NOTHING()
+#endif
+
+#if BLE_LOG_LOCAL_LEVEL >= BLE_LOG_LEVEL_DEBUG
+#define BLE_LOGD(tag, format, ...) BLE_LOG_AT(BLE_LOG_LEVEL_DEBUG, tag, format, ##__VA_ARGS__)
+#else
+#define BLE_LOGD(tag, format, ...) BLE_LOG_NOTHING()
+#endif
+
+#if BLE_LOG_LOCAL_LEVEL >= BLE_LOG_LEVEL_VERBOSE
+#define BLE_LOGV(tag, format, ...) BLE_LOG_AT(BLE_LOG_LEVEL_VERBOSE, tag, format, ##__VA_ARGS__)
+#else
+#define BLE_LOGV(tag, format, ...) BLE_LOG_NOTHING()
+#endif
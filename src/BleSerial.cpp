@@ -6,6 +6,8 @@
 #include <BLE2902.h>
 #include "ByteRingBuffer.h"
 #include "BleSerial.h"
+#include "BleLog.h"
+#include "BleStats.h"
 
 
 
@@ -15,8 +17,12 @@
 #define BLE_TX_UUID "6e400003-b5a3-f393-e0a9-e50e24dcca9e"
 
 #define BLE_BUFFER_SIZE ESP_GATT_MAX_ATTR_LEN // must be greater than MTU, less than ESP_GATT_MAX_ATTR_LEN
-#define MIN_MTU 50
+#define DEFAULT_MTU 23 // ATT MTU before the MTU exchange
+#define NOTIFY_HEADER_SIZE 3 // opcode and handle of a notification
+#define MAX_CONNECTIONS 4
 #define RX_BUFFER_SIZE 4096
+#define TX_QUEUE_LENGTH 8 // frames that may wait for the link
+#define TX_CONF_TIMEOUT_MS 100 // give up waiting for a notify to complete
 
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -34,6 +40,34 @@ class BLERxHandler : public BLECharacteristicCallbacks
     //virtual void onRead(BLECharacteristic *pCharacteristic) override;
 };
 
+/**
+ * BLETxHandler
+ * Callbacks for the result of notifications
+ */
+class BLETxHandler : public BLECharacteristicCallbacks
+{
+    virtual void onStatus(BLECharacteristic *pCharacteristic, Status s, uint32_t code) override;
+};
+
+/**
+ * BleTxFrame
+ * One notification waiting in the TX queue
+ */
+typedef struct BleTxFrame {
+    uint16_t length;
+    uint8_t data[BLE_BUFFER_SIZE];
+} BleTxFrame;
+
+/**
+ * BleConnection
+ * MTU negotiated with one connected client
+ */
+typedef struct BleConnection {
+    bool used;
+    uint16_t connId;
+    uint16_t mtu;
+} BleConnection;
+
 
 /** Unique device name */
 char apName[] = "ESP32-xxxxxxxxxxxx";
@@ -55,17 +89,44 @@ BLE2902 *pDescRx;
 BLE2902 *pDescTx;
 
 BLERxHandler *pRxCallback = NULL;
+BLETxHandler *pTxCallback = NULL;
 
 size_t transmitBufferLength = 0;
 
 ByteRingBuffer<RX_BUFFER_SIZE> receiveBuffer;
 size_t numAvailableLines;
 
+/** What onWrite does with bytes that do not fit into receiveBuffer */
+BleSerialOverflowPolicy overflowPolicy = BLESERIAL_OVERFLOW_REJECT;
+/** Only needed for BLESERIAL_OVERFLOW_OVERWRITE, where the producer also moves the tail */
+portMUX_TYPE receiveMux = portMUX_INITIALIZER_UNLOCKED;
+/** Bytes lost because receiveBuffer was full */
+volatile uint32_t receiveDroppedBytes = 0;
+/** GATT writes lost completely because receiveBuffer was full */
+volatile uint32_t receiveDroppedWrites = 0;
+/** Task blocked in BleSerial_waitAvailable, notified by onWrite */
+static volatile TaskHandle_t receiveTask = NULL;
+
 unsigned long long lastFlushTime;
-uint8_t transmitBuffer[BLE_BUFFER_SIZE] = {0};
 
-uint16_t peerMTU;
-uint16_t maxTransferSize = BLE_BUFFER_SIZE;
+/** Frames of the TX queue, owned by the writer, the ready queue or the TX task */
+BleTxFrame txFrames[TX_QUEUE_LENGTH];
+/** Indexes of frames the writer can fill */
+QueueHandle_t txFreeQueue;
+/** Indexes of filled frames in sending order */
+QueueHandle_t txReadyQueue;
+/** Given when the stack is done with a notification */
+SemaphoreHandle_t txDoneSemaphore;
+/** Given when the stack reports the link is no longer congested */
+SemaphoreHandle_t txUncongestedSemaphore;
+volatile bool txCongested = false;
+/** Frame being filled by the writer, NULL if none */
+BleTxFrame *transmitFrame = NULL;
+
+/** Clients known to the GATTS handler */
+BleConnection connections[MAX_CONNECTIONS];
+/** Payload of one notification, fits the smallest MTU of all connected clients */
+volatile uint16_t maxTransferSize = DEFAULT_MTU - NOTIFY_HEADER_SIZE;
 
 /**
  * MyServerCallbacks
@@ -74,23 +135,80 @@ uint16_t maxTransferSize = BLE_BUFFER_SIZE;
 class MyServerCallbacks: public BLEServerCallbacks {
 	// TODO this doesn't take into account several clients being connected
 	void onConnect(BLEServer* pServer) {
-		Serial.println("BLE client connected");
+		BLE_LOGI("ble", "BLE client connected");
 	};
 
 	void onDisconnect(BLEServer* pServer) {
-		Serial.println("BLE client disconnected");
+		BLE_LOGI("ble", "BLE client disconnected");
 		pAdvertising->start();
 	}
 };
 
+static void BleSerial_wakeReader()
+{
+    TaskHandle_t task = receiveTask;
+    if (task != NULL)
+    {
+        xTaskNotifyGive(task);
+    }
+}
+
 void BLERxHandler::onWrite(BLECharacteristic *pCharacteristic)
 {
     if (pCharacteristic->getUUID().toString() == BLE_RX_UUID)
     {
         std::string value = pCharacteristic->getValue();
+        const uint8_t *data = (const uint8_t *)value.data();
+        size_t length = value.length();
+        size_t space = receiveBuffer.getFree();
+        BleStats_add(BLE_STAT_RX_WRITES);
+        BleStats_add(BLE_STAT_RX_BYTES, length);
+
+        if (length <= space)
+        {
+            receiveBuffer.push(data, length);
+            BleStats_max(BLE_STAT_RX_HIGH_WATER, receiveBuffer.getLength());
+            BleSerial_wakeReader();
+            return;
+        }
+        BleStats_max(BLE_STAT_RX_HIGH_WATER, receiveBuffer.getCapacity());
 
-        for (int i = 0; i < value.length(); i++)
-            receiveBuffer.add(value[i]);
+        switch (overflowPolicy)
+        {
+        case BLESERIAL_OVERFLOW_DROP_NEW:
+            // keep the head of this write, lose its tail
+            receiveBuffer.push(data, space);
+            receiveDroppedBytes += length - space;
+            BleStats_add(BLE_STAT_RX_DROPPED, length - space);
+            break;
+
+        case BLESERIAL_OVERFLOW_OVERWRITE:
+            // keep the newest bytes, lose the oldest ones
+            if (length > receiveBuffer.getCapacity())
+            {
+                data += length - receiveBuffer.getCapacity();
+                receiveDroppedBytes += length - receiveBuffer.getCapacity();
+                BleStats_add(BLE_STAT_RX_DROPPED, length - receiveBuffer.getCapacity());
+                length = receiveBuffer.getCapacity();
+            }
+            portENTER_CRITICAL(&receiveMux);
+            space = receiveBuffer.discard(length - receiveBuffer.getFree());
+            receiveBuffer.push(data, length);
+            portEXIT_CRITICAL(&receiveMux);
+            receiveDroppedBytes += space;
+            BleStats_add(BLE_STAT_RX_OVERWRITTEN, space);
+            break;
+
+        case BLESERIAL_OVERFLOW_REJECT:
+        default:
+            // a write is stored completely or not at all
+            receiveDroppedBytes += length;
+            BleStats_add(BLE_STAT_RX_DROPPED, length);
+            break;
+        }
+        receiveDroppedWrites++;
+        // the reader also wants to know about lost bytes
+        BleSerial_wakeReader();
     }
 }
 
@@ -105,9 +223,45 @@ void createName() {
 	sprintf(apName, "ESP32-%02X%02X%02X%02X%02X%02X", baseMac[0], baseMac[1], baseMac[2], baseMac[3], baseMac[4], baseMac[5]);
 }
 
+void BleSerial_setOverflowPolicy(BleSerialOverflowPolicy policy)
+{
+    overflowPolicy = policy;
+}
+
+BleSerialOverflowPolicy BleSerial_getOverflowPolicy()
+{
+    return overflowPolicy;
+}
+
+uint32_t BleSerial_droppedBytes()
+{
+    return receiveDroppedBytes;
+}
+
+uint32_t BleSerial_droppedWrites()
+{
+    return receiveDroppedWrites;
+}
+
+void BleSerial_resetDropCounters()
+{
+    receiveDroppedBytes = 0;
+    receiveDroppedWrites = 0;
+}
+
 int BleSerial_read()
 {
-    uint8_t result = receiveBuffer.pop();
+    uint8_t result;
+    if (overflowPolicy == BLESERIAL_OVERFLOW_OVERWRITE)
+    {
+        portENTER_CRITICAL(&receiveMux);
+        result = receiveBuffer.pop();
+        portEXIT_CRITICAL(&receiveMux);
+    }
+    else
+    {
+        result = receiveBuffer.pop();
+    }
     if (result == (uint8_t)'\n')
     {
         numAvailableLines--;
@@ -117,13 +271,14 @@ int BleSerial_read()
 
 size_t BleSerial_readBytes(uint8_t *buffer, size_t bufferSize)
 {
-    int i = 0;
-    while (i < bufferSize && BleSerial_available())
+    if (overflowPolicy == BLESERIAL_OVERFLOW_OVERWRITE)
     {
-        buffer[i] = receiveBuffer.pop();
-        i++;
+        portENTER_CRITICAL(&receiveMux);
+        size_t count = receiveBuffer.pop(buffer, bufferSize);
+        portEXIT_CRITICAL(&receiveMux);
+        return count;
     }
-    return i;
+    return receiveBuffer.pop(buffer, bufferSize);
 }
 
 int BleSerial_peek()
@@ -138,60 +293,331 @@ int BleSerial_available()
     return receiveBuffer.getLength();
 }
 
-size_t BleSerial_write(const uint8_t *buffer, size_t bufferSize)
+/**
+ * Block the calling task until count bytes are received or timeoutMs passed,
+ * BLESERIAL_WAIT_FOREVER waits without a timeout. Only one task may wait.
+ * Returns true if count bytes are available.
+ */
+bool BleSerial_waitAvailable(size_t count, uint32_t timeoutMs)
 {
-    if (maxTransferSize < MIN_MTU)
+    receiveTask = xTaskGetCurrentTaskHandle();
+    uint32_t start = millis();
+    // a write that lands after the check leaves its notification pending
+    while (receiveBuffer.getLength() < count)
     {
-        int oldTransferSize = maxTransferSize;
-        peerMTU = pServer->getPeerMTU(pServer->getConnId()) - 5;
-        maxTransferSize = peerMTU > BLE_BUFFER_SIZE ? BLE_BUFFER_SIZE : peerMTU;
+        TickType_t ticks = portMAX_DELAY;
+        if (timeoutMs != BLESERIAL_WAIT_FOREVER)
+        {
+            uint32_t elapsed = millis() - start;
+            if (elapsed >= timeoutMs)
+            {
+                return false;
+            }
+            ticks = pdMS_TO_TICKS(timeoutMs - elapsed);
+            if (ticks == 0)
+            {
+                ticks = 1;
+            }
+        }
+        ulTaskNotifyTake(pdTRUE, ticks);
+    }
+    return true;
+}
+
+size_t BleSerial_free()
+{
+    return receiveBuffer.getFree();
+}
+
+size_t BleSerial_capacity()
+{
+    return receiveBuffer.getCapacity();
+}
 
-        if (maxTransferSize != oldTransferSize)
+/**
+ * Copy data into TX frames, queue every frame that becomes full.
+ * Returns less than length if no free frame showed up in time.
+ */
+static size_t BleSerial_append(const uint8_t *data, size_t length)
+{
+    size_t written = 0;
+    while (written < length)
+    {
+        if (transmitFrame == NULL)
         {
-            log_e("Max BLE transfer size set to %u", maxTransferSize);
+            uint8_t index;
+            if (xQueueReceive(txFreeQueue, &index, pdMS_TO_TICKS(TX_CONF_TIMEOUT_MS * TX_QUEUE_LENGTH)) != pdTRUE)
+            {
+                BLE_LOGE("ble", "BLE TX queue stalled");
+                break;
+            }
+            transmitFrame = &txFrames[index];
+            transmitBufferLength = 0;
+        }
+        size_t frameSize = maxTransferSize;
+        if (transmitBufferLength >= frameSize)
+        {
+            // the MTU shrank while this frame was filled
+            BleSerial_flush();
+            continue;
+        }
+        size_t slice = frameSize - transmitBufferLength;
+        if (slice > length - written)
+        {
+            slice = length - written;
+        }
+        memcpy(&transmitFrame->data[transmitBufferLength], data + written, slice);
+        transmitBufferLength += slice;
+        written += slice;
+        if (transmitBufferLength == frameSize)
+        {
+            BleSerial_flush();
         }
     }
+    return written;
+}
 
-    if (maxTransferSize < MIN_MTU)
+size_t BleSerial_writev(const BleSerialSpan *spans, size_t spanCount)
+{
+    if (pServer->getConnectedCount() == 0)
     {
         return 0;
     }
 
+    // copy whole slices into the frames, each full frame is queued
     size_t written = 0;
-    for (int i = 0; i < bufferSize; i++)
+    for (size_t i = 0; i < spanCount; i++)
     {
-        written += BleSerial_write(buffer[i]);
+        size_t count = BleSerial_append(spans[i].data, spans[i].length);
+        written += count;
+        if (count < spans[i].length)
+        {
+            break;
+        }
     }
     BleSerial_flush();
     return written;
 }
 
+size_t BleSerial_write(const uint8_t *buffer, size_t bufferSize)
+{
+    BleSerialSpan span = { buffer, bufferSize };
+    return BleSerial_writev(&span, 1);
+}
+
 size_t BleSerial_write(uint8_t byte)
 {
     if (pServer->getConnectedCount() == 0)
     {
         return 0;
     }
-    transmitBuffer[transmitBufferLength] = byte;
-    transmitBufferLength++;
-    if (transmitBufferLength == maxTransferSize)
+    return BleSerial_append(&byte, 1);
+}
+
+/**
+ * Like BleSerial_write, but a last partial frame waits for more data or
+ * for BleSerial_flush, so a stream written in pieces fills whole frames
+ */
+size_t BleSerial_queue(const uint8_t *buffer, size_t bufferSize)
+{
+    if (pServer->getConnectedCount() == 0)
     {
-        BleSerial_flush();
+        return 0;
     }
-    return 1;
+    return BleSerial_append(buffer, bufferSize);
 }
 
+/**
+ * Queue the frame being filled, the TX task sends it when the link allows.
+ * Does not wait for the notification to go out.
+ */
 void BleSerial_flush()
 {
-    if (transmitBufferLength > 0)
+    if (transmitFrame == NULL || transmitBufferLength == 0)
+    {
+        return;
+    }
+    transmitFrame->length = transmitBufferLength;
+    uint8_t index = transmitFrame - txFrames;
+    xQueueSend(txReadyQueue, &index, portMAX_DELAY);
+    transmitFrame = NULL;
+    transmitBufferLength = 0;
+}
+
+void BLETxHandler::onStatus(BLECharacteristic *pCharacteristic, Status s, uint32_t code)
+{
+    if (s == ERROR_GATT || s == ERROR_NO_CLIENT || s == ERROR_NOTIFY_DISABLED)
+    {
+        // no completion event will follow
+        BleStats_add(BLE_STAT_TX_FAILURES);
+        xSemaphoreGive(txDoneSemaphore);
+    }
+}
+
+/**
+ * Size TX frames for the smallest MTU of all connected clients,
+ * notify sends the same value to each of them
+ */
+static void BleSerial_updateTransferSize()
+{
+    uint16_t mtu = 0;
+    for (int i = 0; i < MAX_CONNECTIONS; i++)
+    {
+        if (connections[i].used && (mtu == 0 || connections[i].mtu < mtu))
+        {
+            mtu = connections[i].mtu;
+        }
+    }
+    if (mtu == 0)
+    {
+        mtu = DEFAULT_MTU;
+    }
+    uint16_t size = mtu - NOTIFY_HEADER_SIZE;
+    if (size > BLE_BUFFER_SIZE)
+    {
+        size = BLE_BUFFER_SIZE;
+    }
+    if (size != maxTransferSize)
+    {
+        maxTransferSize = size;
+        BLE_LOGI("ble", "Max BLE transfer size set to %u", size);
+    }
+}
+
+static BleConnection *BleSerial_findConnection(uint16_t connId)
+{
+    for (int i = 0; i < MAX_CONNECTIONS; i++)
+    {
+        if (connections[i].used && connections[i].connId == connId)
+        {
+            return &connections[i];
+        }
+    }
+    return NULL;
+}
+
+uint16_t BleSerial_getMTU(uint16_t connId)
+{
+    BleConnection *connection = BleSerial_findConnection(connId);
+    return connection != NULL ? connection->mtu : 0;
+}
+
+size_t BleSerial_frameSize()
+{
+    return maxTransferSize;
+}
+
+/**
+ * Events of the GATT server that the Arduino BLE classes do not forward
+ */
+static void BleSerial_gattsHandler(esp_gatts_cb_event_t event, esp_gatt_if_t gatts_if, esp_ble_gatts_cb_param_t *param)
+{
+    switch (event)
+    {
+    case ESP_GATTS_CONNECT_EVT:
+        for (int i = 0; i < MAX_CONNECTIONS; i++)
+        {
+            if (!connections[i].used)
+            {
+                connections[i].used = true;
+                connections[i].connId = param->connect.conn_id;
+                connections[i].mtu = DEFAULT_MTU;
+                break;
+            }
+        }
+        BleSerial_updateTransferSize();
+        break;
+
+    case ESP_GATTS_DISCONNECT_EVT:
+    {
+        BleConnection *connection = BleSerial_findConnection(param->disconnect.conn_id);
+        if (connection != NULL)
+        {
+            connection->used = false;
+        }
+        BleSerial_updateTransferSize();
+        break;
+    }
+
+    case ESP_GATTS_MTU_EVT:
     {
-        pCharacteristicTx->setValue(transmitBuffer, transmitBufferLength);
-        transmitBufferLength = 0;
+        BleConnection *connection = BleSerial_findConnection(param->mtu.conn_id);
+        if (connection != NULL)
+        {
+            connection->mtu = param->mtu.mtu;
+        }
+        BleSerial_updateTransferSize();
+        break;
+    }
+
+    case ESP_GATTS_CONF_EVT:
+        if (pCharacteristicTx != NULL && param->conf.handle == pCharacteristicTx->getHandle())
+        {
+            xSemaphoreGive(txDoneSemaphore);
+        }
+        break;
+
+    case ESP_GATTS_CONGEST_EVT:
+        txCongested = param->congest.congested;
+        if (txCongested)
+        {
+            BleStats_add(BLE_STAT_TX_CONGESTED);
+        }
+        else
+        {
+            xSemaphoreGive(txUncongestedSemaphore);
+        }
+        break;
+
+    default:
+        break;
     }
-    lastFlushTime = millis();
-    pCharacteristicTx->notify(true);
 }
 
+/**
+ * BleSerial_txTask
+ * Sends queued frames one notification at a time.
+ * The next frame goes out when the stack reports the previous one done
+ * and the link is not congested, instead of after a fixed delay.
+ */
+static void BleSerial_txTask(void *e)
+{
+    uint8_t index;
+    while (true)
+    {
+        xQueueReceive(txReadyQueue, &index, portMAX_DELAY);
+        BleTxFrame *frame = &txFrames[index];
+
+        if (pServer->getConnectedCount() > 0)
+        {
+            while (txCongested)
+            {
+                if (xSemaphoreTake(txUncongestedSemaphore, pdMS_TO_TICKS(TX_CONF_TIMEOUT_MS)) != pdTRUE)
+                {
+                    break;
+                }
+            }
+            // forget a completion that arrived after its wait timed out
+            xSemaphoreTake(txDoneSemaphore, 0);
+            pCharacteristicTx->setValue(frame->data, frame->length);
+            unsigned long start = micros();
+            pCharacteristicTx->notify(true);
+            if (xSemaphoreTake(txDoneSemaphore, pdMS_TO_TICKS(TX_CONF_TIMEOUT_MS)) == pdTRUE)
+            {
+                BleStats_record(BLE_HIST_TX_CONFIRM, micros() - start);
+            }
+            else
+            {
+                BleStats_add(BLE_STAT_TX_TIMEOUTS);
+            }
+            BleStats_add(BLE_STAT_TX_NOTIFICATIONS);
+            BleStats_add(BLE_STAT_TX_BYTES, frame->length);
+            lastFlushTime = millis();
+        }
+        // frames queued while disconnected are dropped
+        xQueueSend(txFreeQueue, &index, 0);
+    }
+}
 
 /**
  * initBLE
@@ -239,6 +665,20 @@ void initBLE() {
     pCharacteristicRx->setCallbacks(pRxCallback);
     pCharacteristicTx->setReadProperty(true);
     pCharacteristicTx->setNotifyProperty(true);
+    pTxCallback = new BLETxHandler();
+    pCharacteristicTx->setCallbacks(pTxCallback);
+
+    // TX queue and the task that paces it
+    txFreeQueue = xQueueCreate(TX_QUEUE_LENGTH, sizeof(uint8_t));
+    txReadyQueue = xQueueCreate(TX_QUEUE_LENGTH, sizeof(uint8_t));
+    txDoneSemaphore = xSemaphoreCreateBinary();
+    txUncongestedSemaphore = xSemaphoreCreateBinary();
+    for (uint8_t i = 0; i < TX_QUEUE_LENGTH; i++)
+    {
+        xQueueSend(txFreeQueue, &i, 0);
+    }
+    BLEDevice::setCustomGattsHandler(BleSerial_gattsHandler);
+    xTaskCreate(BleSerial_txTask, "BleSerialTxTask", 4096, NULL, 2, NULL);
 
 	// Start the service
 	pService->start();
@@ -1,15 +1,46 @@
 #ifndef BLESERIAL_H
 #define BLESERIAL_H
 
+#include <stdint.h>
+#include <stddef.h>
+
+/** What happens to received bytes that do not fit into the receive buffer */
+enum BleSerialOverflowPolicy {
+    BLESERIAL_OVERFLOW_DROP_NEW,   // store what fits, drop the rest of the write
+    BLESERIAL_OVERFLOW_OVERWRITE,  // drop the oldest buffered bytes
+    BLESERIAL_OVERFLOW_REJECT,     // drop the whole write
+};
+
+#define BLESERIAL_WAIT_FOREVER 0xFFFFFFFF
+
+/** One piece of a scatter-gather write */
+struct BleSerialSpan {
+    const uint8_t *data;
+    size_t length;
+};
+
 int BleSerial_read();
 size_t BleSerial_readBytes(uint8_t *buffer, size_t bufferSize);
 int BleSerial_peek();
 int BleSerial_available();
+bool BleSerial_waitAvailable(size_t count, uint32_t timeoutMs);
+size_t BleSerial_free();
+size_t BleSerial_capacity();
 size_t BleSerial_write(const uint8_t *buffer, size_t bufferSize);
+size_t BleSerial_writev(const BleSerialSpan *spans, size_t spanCount);
 size_t BleSerial_write(uint8_t byte);
+size_t BleSerial_queue(const uint8_t *buffer, size_t bufferSize);
 void BleSerial_flush();
+size_t BleSerial_frameSize();
+uint16_t BleSerial_getMTU(uint16_t connId);
 void initBLE();
 
+void BleSerial_setOverflowPolicy(BleSerialOverflowPolicy policy);
+BleSerialOverflowPolicy BleSerial_getOverflowPolicy();
+uint32_t BleSerial_droppedBytes();
+uint32_t BleSerial_droppedWrites();
+void BleSerial_resetDropCounters();
+
 extern char apName[];
 
 #endif // BLESERIAL_H
\ No newline at end of file
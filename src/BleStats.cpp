@@ -0,0 +1,58 @@
+#include "BleStats.h"
+
+std::atomic<uint32_t> bleStatCounters[BLE_STAT_COUNTER_COUNT];
+BleStatHistogramData bleStatHistograms[BLE_STAT_HISTOGRAM_COUNT];
+
+static const char *const counterNames[BLE_STAT_COUNTER_COUNT] = {
+    "rxBytes",
+    "rxWrites",
+    "rxDropped",
+    "rxOverwritten",
+    "rxHighWater",
+    "txBytes",
+    "txNotify",
+    "txFailed",
+    "txTimeout",
+    "txCongested",
+    "frames",
+    "requests",
+    "parseErrors",
+    "crcErrors",
+};
+
+static const char *const histogramNames[BLE_STAT_HISTOGRAM_COUNT] = {
+    "parse",
+    "handlerConfigRead",
+    "handlerConfigWrite",
+    "handlerFileRead",
+    "handlerFileWrite",
+    "handlerOther",
+    "continuation",
+    "txConfirm",
+};
+
+const char *BleStats_counterName(BleStatCounter counter)
+{
+    return counterNames[counter];
+}
+
+const char *BleStats_histogramName(BleStatHistogram histogram)
+{
+    return histogramNames[histogram];
+}
+
+void BleStats_reset()
+{
+    for (size_t i = 0; i < BLE_STAT_COUNTER_COUNT; i++)
+    {
+        bleStatCounters[i].store(0, std::memory_order_relaxed);
+    }
+    for (size_t i = 0; i < BLE_STAT_HISTOGRAM_COUNT; i++)
+    {
+        for (size_t j = 0; j < BLE_STAT_BUCKET_COUNT; j++)
+        {
+            bleStatHistograms[i].buckets[j].store(0, std::memory_order_relaxed);
+        }
+        bleStatHistograms[i].max.store(0, std::memory_order_relaxed);
+    }
+}
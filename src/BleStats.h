@@ -0,0 +1,93 @@
+// Counters and latency histograms of the BLE serial channel
+//
+// Every statistic is a relaxed 32-bit atomic, so any task or BLE callback
+// may update it with one instruction sequence and no lock. Histograms
+// have fixed buckets, recording a value is a short scan and an increment.
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+enum BleStatCounter {
+	BLE_STAT_RX_BYTES,
+	BLE_STAT_RX_WRITES, // GATT writes received
+	BLE_STAT_RX_DROPPED, // bytes rejected or cut off by the overflow policy
+	BLE_STAT_RX_OVERWRITTEN, // old bytes discarded by the overwrite policy
+	BLE_STAT_RX_HIGH_WATER, // most bytes waiting in the receive buffer
+	BLE_STAT_TX_BYTES,
+	BLE_STAT_TX_NOTIFICATIONS,
+	BLE_STAT_TX_FAILURES, // notifications the stack reported as failed
+	BLE_STAT_TX_TIMEOUTS, // notifications without a completion in time
+	BLE_STAT_TX_CONGESTED,
+	BLE_STAT_FRAMES, // framed requests and chunks
+	BLE_STAT_REQUESTS,
+	BLE_STAT_PARSE_ERRORS,
+	BLE_STAT_CRC_FAILURES,
+	BLE_STAT_COUNTER_COUNT
+};
+
+enum BleStatHistogram {
+	BLE_HIST_PARSE, // reading and parsing a request
+	// running a command handler, one histogram per class of commands
+	BLE_HIST_HANDLER_CONFIG_READ,
+	BLE_HIST_HANDLER_CONFIG_WRITE, // saving or erasing configurations
+	BLE_HIST_HANDLER_FILE_READ, // file content and directory listings
+	BLE_HIST_HANDLER_FILE_WRITE,
+	BLE_HIST_HANDLER_OTHER,
+	BLE_HIST_CONTINUATION, // one step of a continuation
+	BLE_HIST_TX_CONFIRM, // notification until its completion event
+	BLE_STAT_HISTOGRAM_COUNT
+};
+
+#define BLE_STAT_BUCKET_COUNT 8
+
+/** Upper bounds in microseconds, the last bucket takes everything above */
+static const uint32_t bleStatBucketBounds[BLE_STAT_BUCKET_COUNT - 1] = {
+	100, 300, 1000, 3000, 10000, 30000, 100000
+};
+
+typedef struct BleStatHistogramData {
+	std::atomic<uint32_t> buckets[BLE_STAT_BUCKET_COUNT];
+	std::atomic<uint32_t> max;
+} BleStatHistogramData;
+
+extern std::atomic<uint32_t> bleStatCounters[BLE_STAT_COUNTER_COUNT];
+extern BleStatHistogramData bleStatHistograms[BLE_STAT_HISTOGRAM_COUNT];
+
+inline void BleStats_add(BleStatCounter counter, uint32_t value = 1)
+{
+	bleStatCounters[counter].fetch_add(value, std::memory_order_relaxed);
+}
+
+/** Raise counter to value if it is lower, for high water marks */
+inline void BleStats_max(std::atomic<uint32_t> &counter, uint32_t value)
+{
+	uint32_t current = counter.load(std::memory_order_relaxed);
+	while (value > current && !counter.compare_exchange_weak(current, value, std::memory_order_relaxed));
+}
+
+inline void BleStats_max(BleStatCounter counter, uint32_t value)
+{
+	BleStats_max(bleStatCounters[counter], value);
+}
+
+inline void BleStats_record(BleStatHistogram histogram, uint32_t us)
+{
+	size_t i = 0;
+	while (i < BLE_STAT_BUCKET_COUNT - 1 && us > bleStatBucketBounds[i])
+		i++;
+	bleStatHistograms[histogram].buckets[i].fetch_add(1, std::memory_order_relaxed);
+	BleStats_max(bleStatHistograms[histogram].max, us);
+}
+
+inline uint32_t BleStats_get(BleStatCounter counter)
+{
+	return bleStatCounters[counter].load(std::memory_order_relaxed);
+}
+
+/** Short name of a counter or histogram for the stats reply */
+const char *BleStats_counterName(BleStatCounter counter);
+const char *BleStats_histogramName(BleStatHistogram histogram);
+
+/** Zero everything, updates racing with it may survive */
+void BleStats_reset();
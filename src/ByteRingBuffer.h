@@ -1,44 +1,132 @@
-// Thread safe ring buffer
+// Lock-free single-producer/single-consumer ring buffer
+//
+// One task may call the producer side (add, push) while another task calls
+// the consumer side (pop, get, getLength, clear) without any locking.
+// Head and tail are free running counters, the slot is selected by masking,
+// so N must be a power of two.
 #pragma once
-#include <Arduino.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <atomic>
 
 template <size_t N>
 class ByteRingBuffer
 {
+	static_assert(N > 0 && (N & (N - 1)) == 0, "ByteRingBuffer size must be a power of two");
+
 private:
+	static const size_t MASK = N - 1;
+
 	uint8_t buffer[N];
-	int head = 0;
-	int tail = 0;
+	// written by the producer only
+	std::atomic<size_t> head{0};
+	// written by the consumer only
+	std::atomic<size_t> tail{0};
 
 public:
-	void add(uint8_t value)
+	// producer: copies as many bytes as fit, returns the number of bytes stored
+	size_t push(const uint8_t *data, size_t length)
+	{
+		size_t h = head.load(std::memory_order_relaxed);
+		size_t t = tail.load(std::memory_order_acquire);
+		size_t space = N - (h - t);
+		if (length > space)
+		{
+			length = space;
+		}
+		if (length == 0)
+		{
+			return 0;
+		}
+		size_t offset = h & MASK;
+		size_t first = N - offset;
+		if (first > length)
+		{
+			first = length;
+		}
+		memcpy(&buffer[offset], data, first);
+		if (length > first)
+		{
+			memcpy(&buffer[0], data + first, length - first);
+		}
+		head.store(h + length, std::memory_order_release);
+		return length;
+	}
+
+	// producer: stores one byte, returns false if the buffer is full
+	bool add(uint8_t value)
 	{
-		buffer[head] = value;
-		head = (head + 1) % N;
-		if (head == tail)
+		// single bytes skip the span arithmetic and memcpy of push
+		size_t h = head.load(std::memory_order_relaxed);
+		if (h - tail.load(std::memory_order_acquire) == N)
 		{
-			tail = (tail + 1) % N;
+			return false;
 		}
+		buffer[h & MASK] = value;
+		head.store(h + 1, std::memory_order_release);
+		return true;
 	}
+
+	// consumer: copies up to length of the oldest bytes, returns the number of bytes copied
+	size_t pop(uint8_t *data, size_t length)
+	{
+		size_t t = tail.load(std::memory_order_relaxed);
+		size_t h = head.load(std::memory_order_acquire);
+		size_t available = h - t;
+		if (length > available)
+		{
+			length = available;
+		}
+		if (length == 0)
+		{
+			return 0;
+		}
+		size_t offset = t & MASK;
+		size_t first = N - offset;
+		if (first > length)
+		{
+			first = length;
+		}
+		memcpy(data, &buffer[offset], first);
+		if (length > first)
+		{
+			memcpy(data + first, &buffer[0], length - first);
+		}
+		tail.store(t + length, std::memory_order_release);
+		return length;
+	}
+
 	uint8_t pop()
 	{
 		// pops the oldest value off the ring buffer
-		if (head == tail)
+		size_t t = tail.load(std::memory_order_relaxed);
+		if (head.load(std::memory_order_acquire) == t)
 		{
 			return -1;
 		}
-		else
+		uint8_t value = buffer[t & MASK];
+		tail.store(t + 1, std::memory_order_release);
+		return value;
+	}
+
+	// consumer: drops up to length of the oldest bytes, returns the number of bytes dropped
+	size_t discard(size_t length)
+	{
+		size_t t = tail.load(std::memory_order_relaxed);
+		size_t available = head.load(std::memory_order_acquire) - t;
+		if (length > available)
 		{
-			uint8_t value = buffer[tail];
-			tail = (tail + 1) % N;
-			return value;
+			length = available;
 		}
+		tail.store(t + length, std::memory_order_release);
+		return length;
 	}
 
+	// consumer: discards everything received so far
 	void clear()
 	{
-		head = 0;
-		tail = 0;
+		tail.store(head.load(std::memory_order_acquire), std::memory_order_release);
 	}
 
 	uint8_t get(size_t index)
@@ -50,20 +138,22 @@ public:
 		}
 		else
 		{
-			return buffer[(tail + index) % N];
+			return buffer[(tail.load(std::memory_order_relaxed) + index) & MASK];
 		}
 	}
 
 	size_t getLength()
 	{
-		if (head >= tail)
-		{
-			return head - tail;
-		}
-		else
-		{
-			return N - tail + head;
-		}
+		return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
 	}
 
+	size_t getFree()
+	{
+		return N - getLength();
+	}
+
+	size_t getCapacity()
+	{
+		return N;
+	}
 };
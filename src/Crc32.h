@@ -0,0 +1,101 @@
+// CRC-32 (IEEE 802.3, reflected, polynomial 0xEDB88320)
+//
+// Same results as the bakercp CRC32 library that was used before.
+// On the ESP32 the crc32_le routine in ROM is used, on a host a
+// slicing-by-8 table kernel that processes eight bytes per step.
+// The running value is always the finalized CRC of the bytes so far,
+// so update() may be called any number of times between reset() and finalize().
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+#if defined(ESP32)
+#include <rom/crc.h>
+#endif
+
+class Crc32
+{
+public:
+	Crc32()
+	{
+		reset();
+	}
+
+	void reset()
+	{
+		value = 0;
+	}
+
+	void update(uint8_t data)
+	{
+		update(&data, 1);
+	}
+
+	void update(const uint8_t *data, size_t length)
+	{
+		value = compute(value, data, length);
+	}
+
+	uint32_t finalize() const
+	{
+		return value;
+	}
+
+	static uint32_t calculate(const uint8_t *data, size_t length)
+	{
+		return compute(0, data, length);
+	}
+
+private:
+	uint32_t value;
+
+#if defined(ESP32)
+	static uint32_t compute(uint32_t crc, const uint8_t *data, size_t length)
+	{
+		return crc32_le(crc, data, length);
+	}
+#else
+	static const uint32_t *table()
+	{
+		static uint32_t slices[8][256];
+		static bool ready = false;
+		if (ready == false) {
+			for (uint32_t i = 0; i < 256; i++) {
+				uint32_t crc = i;
+				for (int bit = 0; bit < 8; bit++)
+					crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+				slices[0][i] = crc;
+			}
+			for (uint32_t i = 0; i < 256; i++) {
+				for (int s = 1; s < 8; s++)
+					slices[s][i] = (slices[s - 1][i] >> 8) ^ slices[0][slices[s - 1][i] & 0xFF];
+			}
+			ready = true;
+		}
+		return &slices[0][0];
+	}
+
+	static uint32_t compute(uint32_t crc, const uint8_t *data, size_t length)
+	{
+		const uint32_t *t = table();
+		crc = ~crc;
+		while (length >= 8) {
+			uint32_t low = crc ^ (data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24));
+			uint32_t high = data[4] | (data[5] << 8) | (data[6] << 16) | ((uint32_t)data[7] << 24);
+			crc = t[7 * 256 + (low & 0xFF)] ^
+				t[6 * 256 + ((low >> 8) & 0xFF)] ^
+				t[5 * 256 + ((low >> 16) & 0xFF)] ^
+				t[4 * 256 + (low >> 24)] ^
+				t[3 * 256 + (high & 0xFF)] ^
+				t[2 * 256 + ((high >> 8) & 0xFF)] ^
+				t[1 * 256 + ((high >> 16) & 0xFF)] ^
+				t[0 * 256 + (high >> 24)];
+			data += 8;
+			length -= 8;
+		}
+		while (length--)
+			crc = (crc >> 8) ^ t[(crc ^ *data++) & 0xFF];
+		return ~crc;
+	}
+#endif
+};
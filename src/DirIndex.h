@@ -0,0 +1,163 @@
+// In-RAM index of the files in the flat SPIFFS root
+//
+// Built once at mount and kept up to date by every path that creates,
+// resizes, renames or removes a file, so listing and used bytes need no
+// flash access. Names are stored without the leading '/' like File::name(),
+// sorted so that a listing can continue after any name.
+// If more files exist than fit, the index reports itself incomplete and
+// the caller falls back to scanning the filesystem.
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#define DIR_INDEX_MAX_FILES 64
+#define DIR_INDEX_MAX_NAME 32
+
+class DirIndex
+{
+public:
+	typedef struct Entry {
+		char name[DIR_INDEX_MAX_NAME + 1];
+		size_t size;
+	} Entry;
+
+	DirIndex()
+	{
+		clear();
+	}
+
+	void clear()
+	{
+		count = 0;
+		usedBytes = 0;
+		complete = true;
+	}
+
+	// adds path or updates its size
+	void set(const char *path, size_t size)
+	{
+		path = strip(path);
+		int i = find(path);
+		if (i >= 0) {
+			usedBytes += size - entries[i].size;
+			entries[i].size = size;
+			return;
+		}
+		if (count >= DIR_INDEX_MAX_FILES || strlen(path) > DIR_INDEX_MAX_NAME) {
+			complete = false;
+			return;
+		}
+		size_t at = lowerBound(path);
+		memmove(&entries[at + 1], &entries[at], (count - at) * sizeof(Entry));
+		strcpy(entries[at].name, path);
+		entries[at].size = size;
+		usedBytes += size;
+		count++;
+	}
+
+	void remove(const char *path)
+	{
+		int i = find(strip(path));
+		if (i < 0)
+			return;
+		usedBytes -= entries[i].size;
+		memmove(&entries[i], &entries[i + 1], (count - i - 1) * sizeof(Entry));
+		count--;
+	}
+
+	void rename(const char *from, const char *to)
+	{
+		int i = find(strip(from));
+		if (i < 0)
+			return;
+		size_t size = entries[i].size;
+		remove(to);
+		remove(from);
+		set(to, size);
+	}
+
+	// size of path, false if it is not in the index
+	bool get(const char *path, size_t *size) const
+	{
+		int i = find(strip(path));
+		if (i < 0)
+			return false;
+		if (size != NULL)
+			*size = entries[i].size;
+		return true;
+	}
+
+	// total size of all files, without path if it is given
+	size_t getUsedBytes(const char *except) const
+	{
+		size_t size = 0;
+		if (except != NULL && get(except, &size))
+			return usedBytes - size;
+		return usedBytes;
+	}
+
+	size_t getCount() const
+	{
+		return count;
+	}
+
+	const Entry &at(size_t index) const
+	{
+		return entries[index];
+	}
+
+	// index of the first entry whose name sorts after name
+	size_t upperBound(const char *name) const
+	{
+		size_t low = 0;
+		size_t high = count;
+		while (low < high) {
+			size_t middle = (low + high) / 2;
+			if (strcmp(entries[middle].name, name) <= 0)
+				low = middle + 1;
+			else
+				high = middle;
+		}
+		return low;
+	}
+
+	bool isComplete() const
+	{
+		return complete;
+	}
+
+private:
+	Entry entries[DIR_INDEX_MAX_FILES];
+	size_t count;
+	size_t usedBytes;
+	bool complete;
+
+	static const char *strip(const char *path)
+	{
+		return path[0] == '/' ? path + 1 : path;
+	}
+
+	// index of the first entry whose name does not sort before name
+	size_t lowerBound(const char *name) const
+	{
+		size_t low = 0;
+		size_t high = count;
+		while (low < high) {
+			size_t middle = (low + high) / 2;
+			if (strcmp(entries[middle].name, name) < 0)
+				low = middle + 1;
+			else
+				high = middle;
+		}
+		return low;
+	}
+
+	int find(const char *name) const
+	{
+		size_t i = lowerBound(name);
+		if (i < count && strcmp(entries[i].name, name) == 0)
+			return i;
+		return -1;
+	}
+};
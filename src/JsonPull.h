@@ -0,0 +1,265 @@
+// Streaming pull parser for JSON requests
+//
+// Reads one byte at a time through a callback and returns one token per
+// next() call, so a request of any size is parsed with a fixed buffer for
+// the text of a single key, string or number. Text longer than that buffer
+// is truncated and reported by isTruncated().
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+class JsonPull
+{
+public:
+	enum Token {
+		JSON_ERROR,
+		JSON_END,
+		JSON_BEGIN_OBJECT,
+		JSON_END_OBJECT,
+		JSON_BEGIN_ARRAY,
+		JSON_END_ARRAY,
+		JSON_KEY,
+		JSON_STRING,
+		JSON_NUMBER,
+		JSON_TRUE,
+		JSON_FALSE,
+		JSON_NULL,
+	};
+
+	// returns the next byte or -1 at the end of the input
+	typedef int (*ReadFunction)(void *context);
+
+	JsonPull(ReadFunction readFunction, void *context, char *text, size_t textSize)
+		: readFunction(readFunction), context(context), text(text), textSize(textSize)
+	{
+		pending = -1;
+		depth = 0;
+		length = 0;
+		truncated = false;
+		text[0] = '\0';
+	}
+
+	Token next()
+	{
+		length = 0;
+		truncated = false;
+		text[0] = '\0';
+
+		int c = readNonSpace();
+		while (c == ',')
+			c = readNonSpace();
+
+		switch (c) {
+		case -1:
+			return JSON_END;
+		case '{':
+			depth++;
+			return JSON_BEGIN_OBJECT;
+		case '}':
+			depth--;
+			return JSON_END_OBJECT;
+		case '[':
+			depth++;
+			return JSON_BEGIN_ARRAY;
+		case ']':
+			depth--;
+			return JSON_END_ARRAY;
+		case '"':
+			if (readString() == false)
+				return JSON_ERROR;
+			// a string followed by a colon is a key
+			c = readNonSpace();
+			if (c == ':')
+				return JSON_KEY;
+			pending = c;
+			return JSON_STRING;
+		case 't':
+			return readLiteral("rue") ? JSON_TRUE : JSON_ERROR;
+		case 'f':
+			return readLiteral("alse") ? JSON_FALSE : JSON_ERROR;
+		case 'n':
+			return readLiteral("ull") ? JSON_NULL : JSON_ERROR;
+		default:
+			if (c == '-' || (c >= '0' && c <= '9')) {
+				readNumber(c);
+				return JSON_NUMBER;
+			}
+			return JSON_ERROR;
+		}
+	}
+
+	// skips the rest of a value whose first token was already returned
+	bool skip(Token token)
+	{
+		if (token != JSON_BEGIN_OBJECT && token != JSON_BEGIN_ARRAY)
+			return token != JSON_ERROR && token != JSON_END;
+		int level = depth - 1;
+		while (depth > level) {
+			Token t = next();
+			if (t == JSON_ERROR || t == JSON_END)
+				return false;
+		}
+		return true;
+	}
+
+	// text of the last key, string or number
+	const char *getText() const
+	{
+		return text;
+	}
+
+	size_t getLength() const
+	{
+		return length;
+	}
+
+	bool isTruncated() const
+	{
+		return truncated;
+	}
+
+	// number of objects and arrays currently open
+	int getDepth() const
+	{
+		return depth;
+	}
+
+private:
+	ReadFunction readFunction;
+	void *context;
+	char *text;
+	size_t textSize;
+	size_t length;
+	bool truncated;
+	int pending;
+	int depth;
+
+	int read()
+	{
+		if (pending >= 0) {
+			int c = pending;
+			pending = -1;
+			return c;
+		}
+		return readFunction(context);
+	}
+
+	int readNonSpace()
+	{
+		int c = read();
+		while (c == ' ' || c == '\t' || c == '\r' || c == '\n')
+			c = read();
+		return c;
+	}
+
+	void append(char c)
+	{
+		if (length + 1 < textSize) {
+			text[length++] = c;
+			text[length] = '\0';
+		} else {
+			truncated = true;
+		}
+	}
+
+	void appendUtf8(uint32_t code)
+	{
+		if (code < 0x80) {
+			append(code);
+		} else if (code < 0x800) {
+			append(0xC0 | (code >> 6));
+			append(0x80 | (code & 0x3F));
+		} else if (code < 0x10000) {
+			append(0xE0 | (code >> 12));
+			append(0x80 | ((code >> 6) & 0x3F));
+			append(0x80 | (code & 0x3F));
+		} else {
+			append(0xF0 | (code >> 18));
+			append(0x80 | ((code >> 12) & 0x3F));
+			append(0x80 | ((code >> 6) & 0x3F));
+			append(0x80 | (code & 0x3F));
+		}
+	}
+
+	int readHex4()
+	{
+		int value = 0;
+		for (int i = 0; i < 4; i++) {
+			int c = read();
+			value <<= 4;
+			if (c >= '0' && c <= '9')
+				value |= c - '0';
+			else if (c >= 'a' && c <= 'f')
+				value |= c - 'a' + 10;
+			else if (c >= 'A' && c <= 'F')
+				value |= c - 'A' + 10;
+			else
+				return -1;
+		}
+		return value;
+	}
+
+	bool readString()
+	{
+		while (true) {
+			int c = read();
+			if (c < 0)
+				return false;
+			if (c == '"')
+				return true;
+			if (c != '\\') {
+				append(c);
+				continue;
+			}
+			c = read();
+			switch (c) {
+			case '"': append('"'); break;
+			case '\\': append('\\'); break;
+			case '/': append('/'); break;
+			case 'b': append('\b'); break;
+			case 'f': append('\f'); break;
+			case 'n': append('\n'); break;
+			case 'r': append('\r'); break;
+			case 't': append('\t'); break;
+			case 'u':
+			{
+				int code = readHex4();
+				if (code < 0)
+					return false;
+				if (code >= 0xD800 && code < 0xDC00) {
+					// high surrogate, the low one follows as another \u escape
+					if (read() != '\\' || read() != 'u')
+						return false;
+					int low = readHex4();
+					if (low < 0xDC00 || low >= 0xE000)
+						return false;
+					appendUtf8(0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00));
+				} else {
+					appendUtf8(code);
+				}
+				break;
+			}
+			default:
+				return false;
+			}
+		}
+	}
+
+	void readNumber(int c)
+	{
+		while (c == '-' || c == '+' || c == '.' || c == 'e' || c == 'E' || (c >= '0' && c <= '9')) {
+			append(c);
+			c = read();
+		}
+		pending = c;
+	}
+
+	bool readLiteral(const char *rest)
+	{
+		for (; *rest; rest++) {
+			if (read() != *rest)
+				return false;
+		}
+		return true;
+	}
+};
@@ -0,0 +1,220 @@
+// Small window LZSS compression for file transfers
+//
+// The stream is a sequence of groups: one flag byte followed by up to eight
+// items, bit i of the flag (lowest first) is 1 for a literal byte and 0 for a
+// match of two bytes:
+//   (distance - 1) & 0xFF, ((distance - 1) >> 8) | ((length - LZSS_MIN_MATCH) << 2)
+// with distance 1..LZSS_WINDOW and length LZSS_MIN_MATCH..LZSS_MAX_MATCH.
+// The stream carries no length, the receiver stops after the uncompressed
+// size it was told in the handshake.
+//
+// RAM is fixed: the encoder holds two windows of data and a hash table
+// (4 KB), the decoder one window (1 KB).
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#define LZSS_WINDOW 1024
+#define LZSS_MIN_MATCH 3
+#define LZSS_MAX_MATCH (LZSS_MIN_MATCH + 63)
+#define LZSS_HASH_SIZE 1024
+
+/** Largest block for one LzssEncoder::compress() call */
+#define LZSS_BLOCK LZSS_WINDOW
+
+/** Worst case output of one compress() or finish() call for length input bytes */
+#define LZSS_BOUND(length) ((length) + (length) / 8 + 18)
+
+/**
+ * LzssEncoder
+ * Compresses a stream given in blocks of up to LZSS_BLOCK bytes.
+ * Matches reach back into the previous blocks, a group that is not full
+ * yet is kept until the next call or finish().
+ */
+class LzssEncoder
+{
+public:
+	LzssEncoder()
+	{
+		reset();
+	}
+
+	void reset()
+	{
+		history = 0;
+		position = 0;
+		groupLength = 0;
+		memset(head, 0, sizeof(head));
+	}
+
+	// compresses length (at most LZSS_BLOCK) bytes, returns the number of bytes written to out
+	size_t compress(const uint8_t *data, size_t length, uint8_t *out)
+	{
+		memcpy(&window[LZSS_WINDOW], data, length);
+		size_t written = 0;
+		size_t end = LZSS_WINDOW + length;
+		size_t i = LZSS_WINDOW;
+		while (i < end) {
+			size_t matchLength = 0;
+			size_t distance = 0;
+			if (end - i >= LZSS_MIN_MATCH) {
+				uint32_t h = hash(&window[i]);
+				distance = (uint16_t)(position + (i - LZSS_WINDOW) - head[h]);
+				head[h] = (uint16_t)(position + (i - LZSS_WINDOW));
+				if (distance > 0 && distance <= LZSS_WINDOW && distance <= history + (i - LZSS_WINDOW)) {
+					size_t limit = end - i;
+					if (limit > LZSS_MAX_MATCH)
+						limit = LZSS_MAX_MATCH;
+					const uint8_t *a = &window[i];
+					const uint8_t *b = a - distance;
+					while (matchLength < limit && a[matchLength] == b[matchLength])
+						matchLength++;
+				}
+			}
+			if (matchLength >= LZSS_MIN_MATCH) {
+				size_t code = distance - 1;
+				addItem(false, code & 0xFF, (code >> 8) | ((matchLength - LZSS_MIN_MATCH) << 2), out, &written);
+				i += matchLength;
+			} else {
+				addItem(true, window[i], 0, out, &written);
+				i++;
+			}
+		}
+		// keep the last window of data for the next block
+		memmove(window, &window[length], LZSS_WINDOW);
+		position += length;
+		history += length;
+		if (history > LZSS_WINDOW)
+			history = LZSS_WINDOW;
+		return written;
+	}
+
+	// writes the last group that is not full, returns the number of bytes written to out
+	size_t finish(uint8_t *out)
+	{
+		size_t written = 0;
+		if (groupLength > 0) {
+			memcpy(out, group, groupLength);
+			written = groupLength;
+			groupLength = 0;
+		}
+		return written;
+	}
+
+private:
+	uint8_t window[2 * LZSS_WINDOW];
+	uint16_t head[LZSS_HASH_SIZE]; // low 16 bits of the stream position of the last 3 bytes with this hash
+	size_t history; // bytes of earlier blocks in the first half of window
+	uint32_t position; // stream position of window[LZSS_WINDOW]
+	uint8_t group[1 + 8 * 2];
+	size_t groupLength;
+	int groupItems;
+
+	static uint32_t hash(const uint8_t *p)
+	{
+		uint32_t v = p[0] | (p[1] << 8) | (p[2] << 16);
+		return (v * 2654435761u) >> (32 - 10);
+	}
+
+	void addItem(bool literal, uint8_t first, uint8_t second, uint8_t *out, size_t *written)
+	{
+		if (groupLength == 0) {
+			group[0] = 0;
+			groupLength = 1;
+			groupItems = 0;
+		}
+		if (literal) {
+			group[0] |= 1 << groupItems;
+			group[groupLength++] = first;
+		} else {
+			group[groupLength++] = first;
+			group[groupLength++] = second;
+		}
+		if (++groupItems == 8) {
+			memcpy(&out[*written], group, groupLength);
+			*written += groupLength;
+			groupLength = 0;
+		}
+	}
+};
+
+/**
+ * LzssDecoder
+ * Decompresses a stream that arrives in pieces of any size.
+ * A match that does not fit into out is continued by the next call.
+ */
+class LzssDecoder
+{
+public:
+	LzssDecoder()
+	{
+		reset();
+	}
+
+	void reset()
+	{
+		position = 0;
+		flags = 0;
+		flagBits = 0;
+		matchByte = -1;
+		copyLength = 0;
+		copyDistance = 0;
+	}
+
+	// decodes from in into out, returns the number of bytes written to out
+	// and the number of input bytes taken in consumed
+	size_t decompress(const uint8_t *in, size_t length, size_t *consumed, uint8_t *out, size_t outSize)
+	{
+		size_t used = 0;
+		size_t written = 0;
+		while (written < outSize) {
+			if (copyLength > 0) {
+				uint8_t c = window[(position - copyDistance) & (LZSS_WINDOW - 1)];
+				put(c, out, &written);
+				copyLength--;
+				continue;
+			}
+			if (used == length)
+				break;
+			if (flagBits == 0) {
+				flags = in[used++];
+				flagBits = 8;
+				continue;
+			}
+			if (flags & 1) {
+				put(in[used++], out, &written);
+				flags >>= 1;
+				flagBits--;
+			} else if (matchByte < 0) {
+				matchByte = in[used++];
+			} else {
+				uint8_t second = in[used++];
+				copyDistance = (matchByte | ((second & 0x03) << 8)) + 1;
+				copyLength = (second >> 2) + LZSS_MIN_MATCH;
+				matchByte = -1;
+				flags >>= 1;
+				flagBits--;
+			}
+		}
+		if (consumed != NULL)
+			*consumed = used;
+		return written;
+	}
+
+private:
+	uint8_t window[LZSS_WINDOW];
+	size_t position;
+	uint8_t flags;
+	int flagBits;
+	int matchByte; // first byte of a match whose second byte has not arrived, -1 if none
+	size_t copyLength;
+	size_t copyDistance;
+
+	void put(uint8_t c, uint8_t *out, size_t *written)
+	{
+		window[position & (LZSS_WINDOW - 1)] = c;
+		position++;
+		out[(*written)++] = c;
+	}
+};
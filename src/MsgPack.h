@@ -0,0 +1,416 @@
+// MessagePack encoding of requests and replies
+//
+// MsgPackWriter writes values into a fixed buffer, a write that does not
+// fit is dropped and reported by overflowed(). MsgPackPull reads a
+// MessagePack value byte by byte and returns the tokens of JsonPull, so
+// the request parser is the same for both encodings. Keys must be strings.
+// Numbers are returned as text like JsonPull does, binary data as a string.
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include "JsonPull.h"
+
+#define MSGPACK_MAX_DEPTH 8
+
+class MsgPackWriter
+{
+public:
+	MsgPackWriter(uint8_t *buffer, size_t capacity)
+		: buffer(buffer), capacity(capacity), length(0), overflow(false)
+	{
+	}
+
+	void writeNil()
+	{
+		put(0xC0);
+	}
+
+	void writeBool(bool value)
+	{
+		put(value ? 0xC3 : 0xC2);
+	}
+
+	void writeUint(uint64_t value)
+	{
+		if (value < 0x80) {
+			put(value);
+		} else if (value <= 0xFF) {
+			put(0xCC);
+			put(value);
+		} else if (value <= 0xFFFF) {
+			put(0xCD);
+			putBigEndian(value, 2);
+		} else if (value <= 0xFFFFFFFF) {
+			put(0xCE);
+			putBigEndian(value, 4);
+		} else {
+			put(0xCF);
+			putBigEndian(value, 8);
+		}
+	}
+
+	void writeInt(int64_t value)
+	{
+		if (value >= 0) {
+			writeUint(value);
+		} else if (value >= -32) {
+			put(value);
+		} else if (value >= INT8_MIN) {
+			put(0xD0);
+			put(value);
+		} else if (value >= INT16_MIN) {
+			put(0xD1);
+			putBigEndian(value, 2);
+		} else if (value >= INT32_MIN) {
+			put(0xD2);
+			putBigEndian(value, 4);
+		} else {
+			put(0xD3);
+			putBigEndian(value, 8);
+		}
+	}
+
+	// as float 32 when that keeps the value
+	void writeDouble(double value)
+	{
+		float f = value;
+		if ((double)f == value) {
+			uint32_t bits;
+			memcpy(&bits, &f, sizeof(bits));
+			put(0xCA);
+			putBigEndian(bits, 4);
+		} else {
+			uint64_t bits;
+			memcpy(&bits, &value, sizeof(bits));
+			put(0xCB);
+			putBigEndian(bits, 8);
+		}
+	}
+
+	void writeString(const char *s)
+	{
+		writeString(s, strlen(s));
+	}
+
+	void writeString(const char *s, size_t n)
+	{
+		if (n < 32) {
+			put(0xA0 | n);
+		} else if (n <= 0xFF) {
+			put(0xD9);
+			put(n);
+		} else if (n <= 0xFFFF) {
+			put(0xDA);
+			putBigEndian(n, 2);
+		} else {
+			put(0xDB);
+			putBigEndian(n, 4);
+		}
+		putBytes((const uint8_t*)s, n);
+	}
+
+	// followed by count values
+	void writeArray(size_t count)
+	{
+		if (count < 16) {
+			put(0x90 | count);
+		} else if (count <= 0xFFFF) {
+			put(0xDC);
+			putBigEndian(count, 2);
+		} else {
+			put(0xDD);
+			putBigEndian(count, 4);
+		}
+	}
+
+	// followed by count keys, each with its value
+	void writeMap(size_t count)
+	{
+		if (count < 16) {
+			put(0x80 | count);
+		} else if (count <= 0xFFFF) {
+			put(0xDE);
+			putBigEndian(count, 2);
+		} else {
+			put(0xDF);
+			putBigEndian(count, 4);
+		}
+	}
+
+	size_t size() const
+	{
+		return length;
+	}
+
+	bool overflowed() const
+	{
+		return overflow;
+	}
+
+private:
+	uint8_t *buffer;
+	size_t capacity;
+	size_t length;
+	bool overflow;
+
+	void put(uint8_t b)
+	{
+		if (length < capacity)
+			buffer[length++] = b;
+		else
+			overflow = true;
+	}
+
+	void putBigEndian(uint64_t value, int bytes)
+	{
+		for (int i = bytes - 1; i >= 0; i--)
+			put(value >> (8 * i));
+	}
+
+	void putBytes(const uint8_t *data, size_t n)
+	{
+		if (n > capacity - length) {
+			overflow = true;
+			length = capacity;
+			return;
+		}
+		memcpy(buffer + length, data, n);
+		length += n;
+	}
+};
+
+class MsgPackPull
+{
+public:
+	typedef JsonPull::Token Token;
+
+	MsgPackPull(JsonPull::ReadFunction readFunction, void *context, char *text, size_t textSize)
+		: readFunction(readFunction), context(context), text(text), textSize(textSize)
+	{
+		depth = 0;
+		length = 0;
+		truncated = false;
+		started = false;
+		text[0] = '\0';
+	}
+
+	Token next()
+	{
+		length = 0;
+		truncated = false;
+		text[0] = '\0';
+
+		bool key = false;
+		if (depth > 0) {
+			Level &level = levels[depth - 1];
+			if (level.remaining == 0) {
+				depth--;
+				return level.map ? JsonPull::JSON_END_OBJECT : JsonPull::JSON_END_ARRAY;
+			}
+			// the items of a map alternate between key and value
+			key = level.map && level.remaining % 2 == 0;
+			level.remaining--;
+		} else if (started) {
+			return JsonPull::JSON_END;
+		}
+		started = true;
+
+		int c = readFunction(context);
+		if (c < 0)
+			return depth == 0 ? JsonPull::JSON_END : JsonPull::JSON_ERROR;
+		Token token = readValue(c);
+		if (key)
+			return token == JsonPull::JSON_STRING ? JsonPull::JSON_KEY : JsonPull::JSON_ERROR;
+		return token;
+	}
+
+	// skips the rest of a value whose first token was already returned
+	bool skip(Token token)
+	{
+		if (token != JsonPull::JSON_BEGIN_OBJECT && token != JsonPull::JSON_BEGIN_ARRAY)
+			return token != JsonPull::JSON_ERROR && token != JsonPull::JSON_END;
+		int level = depth - 1;
+		while (depth > level) {
+			Token t = next();
+			if (t == JsonPull::JSON_ERROR || t == JsonPull::JSON_END)
+				return false;
+		}
+		return true;
+	}
+
+	// text of the last key, string or number
+	const char *getText() const
+	{
+		return text;
+	}
+
+	size_t getLength() const
+	{
+		return length;
+	}
+
+	bool isTruncated() const
+	{
+		return truncated;
+	}
+
+	// number of maps and arrays currently open
+	int getDepth() const
+	{
+		return depth;
+	}
+
+private:
+	typedef struct Level {
+		uint32_t remaining; // items left, a map entry is two
+		bool map;
+	} Level;
+
+	JsonPull::ReadFunction readFunction;
+	void *context;
+	char *text;
+	size_t textSize;
+	size_t length;
+	bool truncated;
+	bool started;
+	int depth;
+	Level levels[MSGPACK_MAX_DEPTH];
+
+	Token readValue(int c)
+	{
+		if (c < 0x80)
+			return setUnsigned(c);
+		if (c >= 0xE0)
+			return setSigned((int8_t)c);
+		if (c < 0x90)
+			return begin(c & 0x0F, true);
+		if (c < 0xA0)
+			return begin(c & 0x0F, false);
+		if (c < 0xC0)
+			return readString(c & 0x1F);
+
+		uint64_t n;
+		switch (c) {
+		case 0xC0:
+			return JsonPull::JSON_NULL;
+		case 0xC2:
+			return JsonPull::JSON_FALSE;
+		case 0xC3:
+			return JsonPull::JSON_TRUE;
+		case 0xC4: case 0xC5: case 0xC6: // bin 8, 16, 32
+			return readBigEndian(1 << (c - 0xC4), &n) ? readString(n) : JsonPull::JSON_ERROR;
+		case 0xD9: case 0xDA: case 0xDB: // str 8, 16, 32
+			return readBigEndian(1 << (c - 0xD9), &n) ? readString(n) : JsonPull::JSON_ERROR;
+		case 0xCA: {
+			float f;
+			uint32_t bits;
+			if (readBigEndian(4, &n) == false)
+				return JsonPull::JSON_ERROR;
+			bits = n;
+			memcpy(&f, &bits, sizeof(f));
+			return setDouble(f);
+		}
+		case 0xCB: {
+			double d;
+			if (readBigEndian(8, &n) == false)
+				return JsonPull::JSON_ERROR;
+			memcpy(&d, &n, sizeof(d));
+			return setDouble(d);
+		}
+		case 0xCC: case 0xCD: case 0xCE: case 0xCF: // uint 8 .. 64
+			return readBigEndian(1 << (c - 0xCC), &n) ? setUnsigned(n) : JsonPull::JSON_ERROR;
+		case 0xD0:
+			return readBigEndian(1, &n) ? setSigned((int8_t)n) : JsonPull::JSON_ERROR;
+		case 0xD1:
+			return readBigEndian(2, &n) ? setSigned((int16_t)n) : JsonPull::JSON_ERROR;
+		case 0xD2:
+			return readBigEndian(4, &n) ? setSigned((int32_t)n) : JsonPull::JSON_ERROR;
+		case 0xD3:
+			return readBigEndian(8, &n) ? setSigned((int64_t)n) : JsonPull::JSON_ERROR;
+		case 0xDC: case 0xDD: // array 16, 32
+			return readBigEndian(c == 0xDC ? 2 : 4, &n) ? begin(n, false) : JsonPull::JSON_ERROR;
+		case 0xDE: case 0xDF: // map 16, 32
+			return readBigEndian(c == 0xDE ? 2 : 4, &n) ? begin(n, true) : JsonPull::JSON_ERROR;
+		default:
+			// extension types
+			return JsonPull::JSON_ERROR;
+		}
+	}
+
+	bool readBigEndian(int bytes, uint64_t *value)
+	{
+		*value = 0;
+		for (int i = 0; i < bytes; i++) {
+			int c = readFunction(context);
+			if (c < 0)
+				return false;
+			*value = (*value << 8) | c;
+		}
+		return true;
+	}
+
+	Token begin(uint64_t count, bool map)
+	{
+		if (depth >= MSGPACK_MAX_DEPTH || count > 0x7FFFFFFF)
+			return JsonPull::JSON_ERROR;
+		levels[depth].remaining = map ? count * 2 : count;
+		levels[depth].map = map;
+		depth++;
+		return map ? JsonPull::JSON_BEGIN_OBJECT : JsonPull::JSON_BEGIN_ARRAY;
+	}
+
+	void append(char c)
+	{
+		if (length + 1 < textSize) {
+			text[length++] = c;
+			text[length] = '\0';
+		} else {
+			truncated = true;
+		}
+	}
+
+	Token readString(uint64_t n)
+	{
+		for (uint64_t i = 0; i < n; i++) {
+			int c = readFunction(context);
+			if (c < 0)
+				return JsonPull::JSON_ERROR;
+			append(c);
+		}
+		return JsonPull::JSON_STRING;
+	}
+
+	Token setUnsigned(uint64_t value)
+	{
+		char digits[20];
+		int n = 0;
+		do {
+			digits[n++] = '0' + value % 10;
+			value /= 10;
+		} while (value > 0);
+		while (n > 0)
+			append(digits[--n]);
+		return JsonPull::JSON_NUMBER;
+	}
+
+	Token setSigned(int64_t value)
+	{
+		if (value >= 0)
+			return setUnsigned(value);
+		append('-');
+		return setUnsigned(0 - (uint64_t)value);
+	}
+
+	Token setDouble(double value)
+	{
+		if (value >= INT32_MIN && value <= INT32_MAX && value == (double)(int32_t)value)
+			return setSigned((int32_t)value);
+		char number[32];
+		snprintf(number, sizeof(number), "%.17g", value);
+		for (const char *c = number; *c; c++)
+			append(*c);
+		return JsonPull::JSON_NUMBER;
+	}
+};
@@ -0,0 +1,83 @@
+// XOR stream codec keyed by the device name
+//
+// Encoding and decoding are the same operation. The key position carries
+// over between calls, so a message may be processed in any number of chunks;
+// reset() starts the next message at the first key byte.
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#define XORCODEC_MAX_KEY 32
+
+class XorCodec
+{
+public:
+	XorCodec()
+	{
+		setKey("");
+	}
+
+	// precompute the keystream, the key is repeated so 4 bytes can be read at any position
+	void setKey(const char *key)
+	{
+		keyLength = strlen(key);
+		if (keyLength > XORCODEC_MAX_KEY)
+			keyLength = XORCODEC_MAX_KEY;
+		for (size_t i = 0; i < keyLength + 3; i++)
+			keystream[i] = keyLength ? key[i % keyLength] : 0;
+		if (keyLength == 0) {
+			keystream[0] = 0;
+			keyLength = 1;
+		}
+		position = 0;
+	}
+
+	void reset()
+	{
+		position = 0;
+	}
+
+	uint8_t apply(uint8_t c)
+	{
+		c ^= keystream[position];
+		if (++position == keyLength)
+			position = 0;
+		return c;
+	}
+
+	void apply(uint8_t *data, size_t length)
+	{
+		// bytes up to a word boundary
+		while (length > 0 && ((uintptr_t)data & 3) != 0) {
+			*data = apply(*data);
+			data++;
+			length--;
+		}
+		// whole words, keys shorter than a word fall back to bytes
+		if (keyLength >= 4) {
+			while (length >= 4) {
+				uint32_t word, key;
+				memcpy(&word, data, 4);
+				memcpy(&key, &keystream[position], 4);
+				word ^= key;
+				memcpy(data, &word, 4);
+				position += 4;
+				if (position >= keyLength)
+					position -= keyLength;
+				data += 4;
+				length -= 4;
+			}
+		}
+		while (length > 0) {
+			*data = apply(*data);
+			data++;
+			length--;
+		}
+	}
+
+private:
+	uint8_t keystream[XORCODEC_MAX_KEY + 3];
+	size_t keyLength;
+	size_t position;
+};
@@ -13,8 +13,17 @@
 #include <Preferences.h>
 #include <FS.h>
 #include <SPIFFS.h>
-#include <CRC32.h>
+#include "Crc32.h"
+#include "DirIndex.h"
+#include "Lzss.h"
+#include "BleLog.h"
+#include "BleStats.h"
 #include "BleSerial.h"
+#include "BleFrame.h"
+#include "JsonPull.h"
+#include "MsgPack.h"
+#include "BleCommand.h"
+#include "XorCodec.h"
 #include <esp_task_wdt.h>
 
 /** Build time */
@@ -36,239 +45,301 @@ StaticJsonBuffer<400> jsonBuffer;
 
 enum RGConfigType {
 	RGCONFIGTYPE_SWITCH,
-    RGCONFIGTYPE_SEEKBAR,
-    RGCONFIGTYPE_SPINNER,
-    RGCONFIGTYPE_NUMBER,
-    RGCONFIGTYPE_TEXT,
+	RGCONFIGTYPE_SEEKBAR,
+	RGCONFIGTYPE_SPINNER,
+	RGCONFIGTYPE_NUMBER,
+	RGCONFIGTYPE_TEXT,
 };
 
-typedef struct RGConfigOption {
-	char o[16];
-} RGConfigOption;
+/** Size of a text value including the terminator */
+#define RG_CONFIG_TEXT_SIZE 32
 
-String RGConfigTypeToString(RGConfigType type);
+constexpr const char *rgco_spinner[] = {
+	"Monday", "Tuesday"
+};
+
+// Configuration schema
+// Integer settings come first, ids follow the order of the lists.
+// RGCI(id, type, name, min, max, defaultValue, summary, options)
+#define RG_CONFIG_INTEGERS(RGCI) \
+	RGCI(SW1, SWITCH, "sw1", 0, 1, 1, "switch Example", nullptr) \
+	RGCI(SB1, SEEKBAR, "sb1", 0, 100, 50, "seekBar Example", nullptr) \
+	RGCI(SP1, SPINNER, "sp1", 0, 2, 1, "spinner Example", rgco_spinner) \
+	RGCI(N1, NUMBER, "n1", 0, 100, 1, "number Example", nullptr)
+// RGCS(id, name, defaultValue, summary)
+#define RG_CONFIG_TEXTS(RGCS) \
+	RGCS(T1, "t1", "default", "text Example") \
+	RGCS(SSID_PRIM, "ssidPrim", "", "1차 SSID") \
+	RGCS(PW_PRIM, "pwPrim", "", "1차 비밀번호") \
+	RGCS(SSID_SEC, "ssidSec", "", "2차 SSID") \
+	RGCS(PW_SEC, "pwSec", "", "2차 비밀번호")
+
+/** Ids of the configurations, RGC_SW1 .. RGC_PW_SEC */
+enum RGConfigId {
+#define RG_CONFIG_ID(id, ...) RGC_##id,
+	RG_CONFIG_INTEGERS(RG_CONFIG_ID)
+	RG_CONFIG_TEXTS(RG_CONFIG_ID)
+#undef RG_CONFIG_ID
+	RGC_COUNT
+};
 
-class RGConfig {
-public:
+#define RG_CONFIG_ONE(...) + 1
+const int rgc_integer_count = 0 RG_CONFIG_INTEGERS(RG_CONFIG_ONE);
+#undef RG_CONFIG_ONE
+const int rgc_array_count = RGC_COUNT;
+
+/** Everything of a configuration but its value, constant and kept in flash */
+typedef struct RGConfigDesc {
 	RGConfigType type;
-	char name[8];
+	const char *name;
 	int min;
 	int max;
-	char summary[32];
-	RGConfigOption *options;
-	int options_count;
-
-	RGConfig(RGConfigType type, char name[8], int min, int max, char summary[32], RGConfigOption *options, int options_count) {
-		this->type = type;
-		strcpy(this->name, name);
-		this->min = min;
-		this->max = max;
-		strcpy(this->summary, summary);
-		this->options = options;
-		this->options_count = options_count;
-	}
+	int defaultValue; // integer configurations
+	const char *defaultText; // text configurations, NULL for integers
+	const char *summary;
+	const char *const *options;
+	uint8_t options_count;
+} RGConfigDesc;
+
+template <size_t N> constexpr uint8_t RGConfig_optionCount(const char *const (&)[N]) { return N; }
+constexpr uint8_t RGConfig_optionCount(decltype(nullptr)) { return 0; }
+
+constexpr RGConfigDesc rgc_desc[] = {
+#define RG_CONFIG_INTEGER_DESC(id, type, name, min, max, defaultValue, summary, options) \
+	{ RGCONFIGTYPE_##type, name, min, max, defaultValue, NULL, summary, options, RGConfig_optionCount(options) },
+#define RG_CONFIG_TEXT_DESC(id, name, defaultValue, summary) \
+	{ RGCONFIGTYPE_TEXT, name, 0, RG_CONFIG_TEXT_SIZE, 0, defaultValue, summary, NULL, 0 },
+	RG_CONFIG_INTEGERS(RG_CONFIG_INTEGER_DESC)
+	RG_CONFIG_TEXTS(RG_CONFIG_TEXT_DESC)
+#undef RG_CONFIG_INTEGER_DESC
+#undef RG_CONFIG_TEXT_DESC
+};
+static_assert(sizeof(rgc_desc) / sizeof(rgc_desc[0]) == RGC_COUNT, "one descriptor per configuration");
 
-	virtual void Get(Preferences *p) = 0;
+/** Live values, the only part of the configurations in RAM */
+int rgc_int_values[rgc_integer_count];
+char rgc_text_values[RGC_COUNT - rgc_integer_count][RG_CONFIG_TEXT_SIZE];
 
-	virtual void Put(Preferences *p) = 0;
+/** Number of the saved values, increased by every save that changes one */
+uint32_t rgc_version = 0;
+#define RG_CONFIG_VERSION_KEY "_version"
 
-	virtual void ToJson(JsonObject &jo) = 0;
+/** Configurations changed since they were loaded or saved, one bit per id */
+uint32_t rgc_dirty = 0;
+static_assert(RGC_COUNT <= 32, "one dirty bit per configuration");
 
-	virtual void ToJsonArrayValue(JsonArray &jo) = 0;
+inline bool RGConfig_isText(int id) {
+	return id >= rgc_integer_count;
+}
 
-	virtual void FromJson(JsonObject &jo) = 0;
+inline char *RGConfig_textAt(int id) {
+	return rgc_text_values[id - rgc_integer_count];
+}
 
-	virtual void FromJsonArrayValue(JsonArray &ja)  = 0;
+// Typed accessors, using the wrong one for a configuration does not compile
+template <RGConfigId id> inline int &RGConfig_int() {
+	static_assert(id < rgc_integer_count, "not an integer configuration");
+	return rgc_int_values[id];
+}
 
-protected:	
-	void ToJsonInternal(JsonObject &jo) {
-		jo["name"] = this->name;
-		jo["type"] = RGConfigTypeToString(this->type);
-		jo["min"] = this->min;
-		jo["max"] = this->max;
-		jo["summary"] = this->summary;
-		JsonArray &ja = jo.createNestedArray("options");
-		for(int i = 0; i < this->options_count; i++) {
-			ja.add(this->options[i].o);
-		}
-	}
-};
+template <RGConfigId id> inline char *RGConfig_text() {
+	static_assert(id >= rgc_integer_count && id < RGC_COUNT, "not a text configuration");
+	return rgc_text_values[id - rgc_integer_count];
+}
 
-class RGConfigInteger : public RGConfig {
-public:
-	int value;
-	int defaultValue;
+constexpr bool RGConfig_nameEquals(const char *a, const char *b) {
+	return *a == *b && (*a == '\0' || RGConfig_nameEquals(a + 1, b + 1));
+}
 
-	RGConfigInteger(RGConfigType type, char name[8], int value, int min, int max, int defaultValue, char summary[32], RGConfigOption *options, int options_count)
-		: RGConfig(type, name, min, max, summary, options, options_count)
-	{
-		this->value = value;
-		this->defaultValue = defaultValue;
-	}
+/** Id of the configuration called name, RGC_COUNT if there is none. Constant for a constant name */
+constexpr int RGConfig_find(const char *name, int id = 0) {
+	return id >= RGC_COUNT ? (int)RGC_COUNT
+		: RGConfig_nameEquals(rgc_desc[id].name, name) ? id
+		: RGConfig_find(name, id + 1);
+}
+static_assert(RGConfig_find("ssidPrim") == RGC_SSID_PRIM, "names and ids agree");
 
-	virtual void Get(Preferences *p) override {
-		this->value = p->getInt(this->name, this->defaultValue);
-	}
+// FNV-1a over everything a descriptor is built from, see rgc_schema_hash
+constexpr uint32_t RGConfig_hashByte(uint8_t b, uint32_t h) {
+	return (h ^ b) * 16777619u;
+}
 
-	virtual void Put(Preferences *p) override {
-		p->putInt(this->name, this->value);
-	}
+constexpr uint32_t RGConfig_hashInt(uint32_t v, uint32_t h) {
+	return RGConfig_hashByte(v >> 24, RGConfig_hashByte(v >> 16, RGConfig_hashByte(v >> 8, RGConfig_hashByte(v, h))));
+}
 
-	virtual void ToJson(JsonObject &jo) override {
-		RGConfig::ToJsonInternal(jo);
-		jo["value"].set<int>(this->value);
-		jo["defaultValue"].set<int>(this->defaultValue);
-	}
+constexpr uint32_t RGConfig_hashText(const char *s, uint32_t h) {
+	// the terminator keeps "ab","c" apart from "a","bc"
+	return RGConfig_hashByte(0, BleCommand_hash(s != NULL ? s : "", h));
+}
 
-	virtual void ToJsonArrayValue(JsonArray &ja) override {
-		/*
-		Serial.print("v ");
-		Serial.print((uint32_t)(&this->value), HEX);
-		Serial.print(" ");
-		Serial.print(this->value);
-		Serial.print(" ");
-		Serial.println(String(this->value));
-		*/
-		ja.add(String(this->value));
-	}
+constexpr uint32_t RGConfig_hashOptions(const RGConfigDesc &desc, int i, uint32_t h) {
+	return i >= desc.options_count ? h : RGConfig_hashOptions(desc, i + 1, RGConfig_hashText(desc.options[i], h));
+}
 
-	virtual void FromJson(JsonObject &jo) override {
-		// Is it useful?
-	}
+constexpr uint32_t RGConfig_hashDesc(const RGConfigDesc &desc, uint32_t h) {
+	return RGConfig_hashOptions(desc, 0,
+		RGConfig_hashText(desc.summary,
+		RGConfig_hashText(desc.defaultText,
+		RGConfig_hashInt(desc.defaultValue,
+		RGConfig_hashInt(desc.max,
+		RGConfig_hashInt(desc.min,
+		RGConfig_hashInt(desc.type,
+		RGConfig_hashText(desc.name, h))))))));
+}
 
-	virtual void FromJsonArrayValue(JsonArray &ja) override {
-		String s = ja.get<String>(0);
-		this->value = s.toInt();
-		ja.remove(0);
-		/*
-		Serial.print("v ");
-		Serial.print((uint32_t)(&this->value), HEX);
-		Serial.print(" ");
-		Serial.print(this->value);
-		Serial.print(" ");
-		Serial.println(String(this->value));
-		*/
-	}
-};
+constexpr uint32_t RGConfig_schemaHash(int id, uint32_t h) {
+	return id >= RGC_COUNT ? h : RGConfig_schemaHash(id + 1, RGConfig_hashDesc(rgc_desc[id], h));
+}
 
-class RGConfigString : public RGConfig {
-public:
-	char value[32];
-	char defaultValue[32];
+/** Descriptor JSON without the values, bump the first number when its layout changes */
+#define RG_CONFIG_SCHEMA_FORMAT 1
 
-	RGConfigString(RGConfigType type, char name[8], char value[8], int min, int max, char defaultValue[8], char summary[32], RGConfigOption *options, int options_count)
-		: RGConfig(type, name, min, max, summary, options, options_count)
-	{
-		strcpy(this->value, value);
-		strcpy(this->defaultValue, defaultValue);
-	}
+/**
+ * Hash of the schema, computed by the compiler. It changes with any
+ * name, range, default, summary or option, clients cache descriptors by it.
+ */
+const uint32_t rgc_schema_hash = std::integral_constant<uint32_t,
+	RGConfig_schemaHash(0, RGConfig_hashInt(RG_CONFIG_SCHEMA_FORMAT, 2166136261u))>::value;
 
-	virtual void Get(Preferences *p) override {
-		String s = p->getString(this->name, this->defaultValue);
-		strcpy(this->value, (char*)&s[0]);
-	}
-	
-	virtual void Put(Preferences *p) override {
-		p->putString(this->name, this->value);
+const char *RGConfigTypeToString(RGConfigType type) {
+	switch(type) {
+	case RGCONFIGTYPE_SWITCH: return "Switch";
+	case RGCONFIGTYPE_SEEKBAR: return "SeekBar";
+	case RGCONFIGTYPE_SPINNER: return "Spinner";
+	case RGCONFIGTYPE_NUMBER: return "Number";
+	case RGCONFIGTYPE_TEXT: return "Text";
 	}
+	return "Unknown";
+}
 
-	virtual void ToJson(JsonObject &jo) override {
-		RGConfig::ToJsonInternal(jo);
-		jo["value"].set<String>(this->value);
-		jo["defaultValue"].set<String>(this->defaultValue);
+/** Read one configuration from preferences, the default if it is not stored */
+void RGConfig_get(Preferences *p, int id) {
+	const RGConfigDesc &desc = rgc_desc[id];
+	if (!RGConfig_isText(id)) {
+		rgc_int_values[id] = p->getInt(desc.name, desc.defaultValue);
+	} else if (p->getString(desc.name, RGConfig_textAt(id), RG_CONFIG_TEXT_SIZE) == 0) {
+		strcpy(RGConfig_textAt(id), desc.defaultText);
 	}
+}
 
-	virtual void ToJsonArrayValue(JsonArray &ja) override {
-		/*
-		Serial.print("v ");
-		Serial.print((uint32_t)(&this->value), HEX);
-		Serial.print(" ");
-		Serial.print(this->value);
-		Serial.print(" ");
-		*/
-		Serial.println(String(this->value));
-		ja.add(this->value);
+/**
+ * Descriptor of one configuration, the strings point into flash and are not copied.
+ * Without the value it only depends on the schema.
+ */
+void RGConfig_toJson(JsonObject &jo, int id, bool withValue = true) {
+	const RGConfigDesc &desc = rgc_desc[id];
+	jo["name"] = desc.name;
+	jo["type"] = RGConfigTypeToString(desc.type);
+	jo["min"] = desc.min;
+	jo["max"] = desc.max;
+	jo["summary"] = desc.summary;
+	JsonArray &ja = jo.createNestedArray("options");
+	for(int i = 0; i < desc.options_count; i++) {
+		ja.add(desc.options[i]);
 	}
-	
-	virtual void FromJson(JsonObject &jo) override {
-		// Is it useful?
+	if (RGConfig_isText(id)) {
+		if (withValue)
+			jo["value"] = (const char*)RGConfig_textAt(id);
+		jo["defaultValue"] = desc.defaultText;
+	} else {
+		if (withValue)
+			jo["value"].set<int>(rgc_int_values[id]);
+		jo["defaultValue"].set<int>(desc.defaultValue);
 	}
+}
 
-	virtual void FromJsonArrayValue(JsonArray &ja) override {
-		String s = ja.get<String>(0);
-		strcpy(this->value, (char*)&s[0]);
-		ja.remove(0);
-		/*
-		Serial.print("v ");
-		Serial.print((uint32_t)(&this->value), HEX);
-		Serial.print(" ");
-		Serial.print(this->value);
-		Serial.print(" ");
-		Serial.println(String(this->value));
-		*/
+/**
+ * Value of one configuration. JSON clients get integers as text like
+ * always, native ones are for MessagePack replies.
+ */
+void RGConfig_toJsonArrayValue(JsonArray &ja, int id, bool native = false) {
+	if (RGConfig_isText(id)) {
+		BLE_LOGV("config", "%s", RGConfig_textAt(id));
+		ja.add((const char*)RGConfig_textAt(id));
+	} else if (native) {
+		ja.add(rgc_int_values[id]);
+	} else {
+		ja.add(String(rgc_int_values[id]));
 	}
+}
 
-};
-
-String RGConfigTypeToString(RGConfigType type) {
-	String s = "Unknown";
-	switch(type) {
-	case RGCONFIGTYPE_SWITCH: s = "Switch"; break;
-    case RGCONFIGTYPE_SEEKBAR: s = "SeekBar"; break;
-    case RGCONFIGTYPE_SPINNER: s = "Spinner"; break;
-    case RGCONFIGTYPE_NUMBER: s = "Number"; break;
-    case RGCONFIGTYPE_TEXT: s = "Text"; break;
+void RGConfig_fromString(int id, const char *s) {
+	if (RGConfig_isText(id)) {
+		char *value = RGConfig_textAt(id);
+		size_t length = strnlen(s, RG_CONFIG_TEXT_SIZE - 1);
+		if (strncmp(value, s, length) == 0 && value[length] == '\0')
+			return;
+		memcpy(value, s, length);
+		value[length] = '\0';
+	} else {
+		int value = atoi(s);
+		if (rgc_int_values[id] == value)
+			return;
+		rgc_int_values[id] = value;
 	}
-	return s;
+	rgc_dirty |= 1UL << id;
 }
 
-RGConfigOption rgco_spinner[2] = {
-	"Monday", "Tuesday"
-};
-const int rgco_spinner_count = sizeof(rgco_spinner) / sizeof(RGConfigOption);
-
-RGConfigInteger rgci_array[] = {
-	RGConfigInteger(RGCONFIGTYPE_SWITCH, (char*)"sw1", 0, 0, 1, 1, (char*)"switch Example", NULL, 0),
-	RGConfigInteger(RGCONFIGTYPE_SEEKBAR, (char*)"sb1", 50, 0, 100, 50, (char*)"seekBar Example", NULL, 0 ),
-	RGConfigInteger(RGCONFIGTYPE_SPINNER, (char*)"sp1", 1, 0, 2, 1, (char*)"spinner Example", rgco_spinner, rgco_spinner_count ),
-	RGConfigInteger(RGCONFIGTYPE_NUMBER, (char*)"n1", 10, 0, 100, 1, (char*)"number Example", NULL, 0 ),
-};
+/** Read all configurations from preferences */
+void loadConfigs() {
+	Preferences p;
+	p.begin("configs", false);
+	for(int i = 0; i < rgc_array_count; i++) {
+		RGConfig_get(&p, i);
+	}
+	uint32_t version = p.getUInt(RG_CONFIG_VERSION_KEY, 0);
+	if (version != 0) {
+		rgc_version = version;
+	} else {
+		// nothing saved yet or the nvs was erased, the values are the defaults
+		// now: take a new random version so clients do not take it for one
+		// they have cached, not even the one before the erase
+		uint32_t previous = rgc_version;
+		do {
+			rgc_version = (esp_random() >> 1) | 1;
+		} while (rgc_version == previous);
+	}
+	p.end();
+	rgc_dirty = 0;
+}
 
-RGConfigString rgcs_array[] = {
-	RGConfigString(RGCONFIGTYPE_TEXT, (char*)"t1", (char*)"test", 0, 32, (char*)"default", (char*)"text Example", NULL, 0 ),
-	RGConfigString(RGCONFIGTYPE_TEXT, (char*)"ssidPrim", (char*)"test", 0, 32, (char*)"", (char*)"1차 SSID", NULL, 0 ),
-	RGConfigString(RGCONFIGTYPE_TEXT, (char*)"pwPrim", (char*)"test", 0, 32, (char*)"", (char*)"1차 비밀번호", NULL, 0 ),
-	RGConfigString(RGCONFIGTYPE_TEXT, (char*)"ssidSec", (char*)"test", 0, 32, (char*)"", (char*)"2차 SSID", NULL, 0 ),
-	RGConfigString(RGCONFIGTYPE_TEXT, (char*)"pwSec", (char*)"test", 0, 32, (char*)"", (char*)"2차 비밀번호", NULL, 0 ),
-};
+/**
+ * Write the changed configurations with a single commit and add their
+ * names to persisted. Uses nvs directly, Preferences commits every put.
+ */
+esp_err_t saveConfigs(JsonArray &persisted) {
+	if (rgc_dirty == 0)
+		return ESP_OK;
+	nvs_handle handle;
+	esp_err_t err = nvs_open("configs", NVS_READWRITE, &handle);
+	if (err != ESP_OK)
+		return err;
+	for(int i = 0; i < rgc_array_count && err == ESP_OK; i++) {
+		if ((rgc_dirty & (1UL << i)) == 0)
+			continue;
+		if (RGConfig_isText(i)) {
+			err = nvs_set_str(handle, rgc_desc[i].name, RGConfig_textAt(i));
+		} else {
+			err = nvs_set_i32(handle, rgc_desc[i].name, rgc_int_values[i]);
+		}
+	}
+	if (err == ESP_OK)
+		err = nvs_set_u32(handle, RG_CONFIG_VERSION_KEY, rgc_version + 1);
+	if (err == ESP_OK)
+		err = nvs_commit(handle);
+	nvs_close(handle);
+	if (err != ESP_OK)
+		return err;
+	rgc_version++;
 
-RGConfig* rgc_array[] = {
-	&rgci_array[0],
-	&rgci_array[1],
-	&rgci_array[2],
-	&rgci_array[3],
-	&rgcs_array[0],
-	&rgcs_array[1],
-	&rgcs_array[2],
-	&rgcs_array[3],
-	&rgcs_array[4],
-};
-const int rgc_array_count = sizeof(rgc_array) / sizeof(RGConfig*);
-
-// Accessor for Configurations
-#define RGCI_VALUE(a) (((RGConfigInteger*)rgc_array[a])->value)
-#define RGCS_VALUE(a) (((RGConfigString*)rgc_array[a])->value)
-
-// Indexes of Configurations
-#define E_SW1 0
-#define E_SB1 E_SW1 + 1
-#define E_SP1 E_SB1 + 1
-#define E_N1 E_SP1 + 1
-#define E_T1 E_N1 + 1
-#define E_SSID_PRIM E_T1 + 1
-#define E_PW_PRIM E_SSID_PRIM + 1
-#define E_SSID_SEC E_PW_PRIM + 1
-#define E_PW_SEC E_SSID_SEC + 1
+	for(int i = 0; i < rgc_array_count; i++) {
+		if (rgc_dirty & (1UL << i))
+			persisted.add(rgc_desc[i].name);
+	}
+	rgc_dirty = 0;
+	return ESP_OK;
+}
 
 /** Callback for receiving IP address from AP */
 void gotIP(arduino_event_id_t event) {
@@ -318,13 +389,13 @@ bool scanWiFi() {
 	for (int index=0; index<apNum; index++) {
 		String ssid = WiFi.SSID(index);
 		Serial.println("Found AP: " + ssid + " RSSI: " + WiFi.RSSI(index));
-		if (!strcmp((const char*) &ssid[0], RGCS_VALUE(E_SSID_PRIM))) {
+		if (!strcmp((const char*) &ssid[0], RGConfig_text<RGC_SSID_PRIM>())) {
 			Serial.println("Found primary AP");
 			foundAP++;
 			foundPrim = true;
 			rssiPrim = WiFi.RSSI(index);
 		}
-		if (!strcmp((const char*) &ssid[0], RGCS_VALUE(E_SSID_SEC))) {
+		if (!strcmp((const char*) &ssid[0], RGConfig_text<RGC_SSID_SEC>())) {
 			Serial.println("Found secondary AP");
 			foundAP++;
 			rssiSec = WiFi.RSSI(index);
@@ -372,11 +443,11 @@ void connectWiFi() {
 	Serial.println();
 	Serial.print("Start connection to ");
 	if (usePrimAP) {
-		Serial.println(RGCS_VALUE(E_SSID_PRIM));
-		WiFi.begin(RGCS_VALUE(E_SSID_PRIM), RGCS_VALUE(E_PW_PRIM));
+		Serial.println(RGConfig_text<RGC_SSID_PRIM>());
+		WiFi.begin(RGConfig_text<RGC_SSID_PRIM>(), RGConfig_text<RGC_PW_PRIM>());
 	} else {
-		Serial.println(RGCS_VALUE(E_SSID_SEC));
-		WiFi.begin(RGCS_VALUE(E_SSID_SEC), RGCS_VALUE(E_PW_SEC));
+		Serial.println(RGConfig_text<RGC_SSID_SEC>());
+		WiFi.begin(RGConfig_text<RGC_SSID_SEC>(), RGConfig_text<RGC_PW_SEC>());
 	}
 }
 
@@ -385,51 +456,410 @@ uint8_t ble_read_buffer[BUFFER_SIZE];
 uint8_t ble_write_buffer[BUFFER_SIZE];
 uint16_t ble_read_count;
 uint16_t ble_write_count;
-uint8_t ble_timer10ms;
-uint16_t ble_state = 100;
-uint8_t ble_state_timer100ms;
 String ble_write_string;
-String ble_read_string;
 String ble_file_name;
 size_t ble_file_size;
 uint32_t ble_file_crc = 0;
-const uint8_t ble_file_timeout_100ms = 30;
-int ble_config_index;
+const uint32_t ble_file_timeout_ms = 3000;
 
-void BleSerial_decode(uint8_t *value, uint32_t value_size)
+/** Milliseconds until deadline, a millis() value, 0 once it passed */
+uint32_t timeLeft(uint32_t deadline)
 {
-    // Decode data    
-	int keyIndex = 0;
-    Serial.print("Received over BLESerial: ");
-    for (int index = 0; index < value_size; index ++) {
-        value[index] = (char) value[index] ^ (char) apName[keyIndex];
-        if (index < 10) {
-            Serial.print(value[index], HEX);
-        }
-        keyIndex++;
-        if (keyIndex >= strlen(apName)) keyIndex = 0;
-    }
-    Serial.print(" size ");
-    Serial.println(value_size);
+	int32_t left = (int32_t)(deadline - millis());
+	return left > 0 ? left : 0;
 }
+/** Size of the LZSS stream of the file being transferred, 0 if sent raw */
+size_t ble_file_compressed_size = 0;
+bool ble_file_compressed = false;
+LzssEncoder ble_lzss_encoder;
+LzssDecoder ble_lzss_decoder;
 
-void BleSerial_encode(uint8_t *value, uint32_t value_size)
+/** Codecs of received and transmitted messages, keyed by apName */
+XorCodec ble_rx_codec;
+XorCodec ble_tx_codec;
+
+/** Decoder for the header of framed requests */
+BleFrameDecoder ble_frame_decoder;
+
+/**
+ * Second phase of a command that waits for something, called again
+ * until it clears request->continuation
+ */
+typedef void (*BleContinuation)(struct BleRequest *request);
+
+/** Fields of a request, filled by BleRequest_parse */
+typedef struct BleRequest {
+	uint32_t command; // BleCommand_key of verb and name, 0 if none
+	int config_index;
+	char fileName[33];
+	bool hasFileName;
+	size_t fileSize;
+	bool hasFileSize;
+	uint32_t fileCRC;
+	bool hasFileCRC;
+	bool chunked; // upload in BLE_FRAME_FILE_CHUNK frames
+	bool resume; // continue an interrupted chunked upload
+	bool hasCompression; // the client asked for a compression
+	bool compressed; // the compression asked for is "lzss"
+	size_t compressedSize; // size of the LZSS stream of an upload
+	bool hasCompressedSize;
+	char cursor[33]; // listDir continues after this name
+	int pageSize; // listDir entries per reply, 0 for the default
+	char prefix[33]; // listDir filter, empty for any
+	char glob[33]; // listDir filter with * and ?, empty for any
+	int depth; // listDir levels of '/' in a name, -1 for any
+	bool clear; // zero the statistics after read:stats
+	bool valuesApplied; // "value" array or object was written into the configurations
+	uint32_t version; // read:value replies notModified if the values have this version
+	bool hasVersion;
+	uint32_t schemaHash; // read:configs replies notModified if the schema has this hash
+	bool hasSchemaHash;
+	uint32_t id; // echoed in every reply, lets the client match replies to requests
+	bool hasId;
+	// set when the request is received, not by BleRequest_parse
+	bool framed; // replies are framed like the request
+	bool msgpack; // the request was MessagePack, so are the replies
+	uint8_t sequence;
+	uint8_t state; // BleRequestState
+	uint32_t order; // arrival number, queued requests run oldest first
+	BleContinuation continuation; // second phase of the command, NULL when done
+	uint32_t wakeAt; // millis() before which the continuation is not called
+} BleRequest;
+
+enum BleRequestState {
+	BLE_REQUEST_FREE,
+	BLE_REQUEST_QUEUED,
+	BLE_REQUEST_RUNNING, // waits in its continuation
+};
+
+/**
+ * Requests in flight. The client may send the next request before the reply
+ * to the previous one, requests are parsed ahead and a command waiting
+ * in its continuation does not hold back the ones behind it.
+ */
+#define BLE_REQUEST_SLOTS 4
+BleRequest ble_requests[BLE_REQUEST_SLOTS];
+uint32_t ble_request_order = 0;
+/** Replies go to this request, they use its framing, sequence and id */
+BleRequest *ble_reply_request = NULL;
+
+void BleSerial_packJson(MsgPackWriter &writer, JsonObject &jo);
+void BleSerial_packJson(MsgPackWriter &writer, JsonArray &ja);
+
+/** One value of a reply tree as MessagePack */
+void BleSerial_packJson(MsgPackWriter &writer, const JsonVariant &value)
 {
-    // encode the data
-    int keyIndex = 0;
-    Serial.print("Transmit over BLESerial: ");
-    for (int index = 0; index < value_size; index ++) {
-        if (index < 10) {
-            Serial.print(value[index], HEX);
-        }
-        value[index] = (char) value[index] ^ (char) apName[keyIndex];
-        keyIndex++;
-        if (keyIndex >= strlen(apName)) keyIndex = 0;
-    }
-    Serial.print(" size ");
-    Serial.println(value_size);
+	if (value.is<JsonObject>()) {
+		BleSerial_packJson(writer, value.as<JsonObject>());
+	} else if (value.is<JsonArray>()) {
+		BleSerial_packJson(writer, value.as<JsonArray>());
+	} else if (value.is<const char*>()) {
+		writer.writeString(value.as<const char*>());
+	} else if (value.is<bool>()) {
+		writer.writeBool(value.as<bool>());
+	} else if (value.is<long>()) {
+		// as<long>() would wrap the unsigned values above LONG_MAX
+		if (value.as<double>() < 0)
+			writer.writeInt(value.as<long>());
+		else
+			writer.writeUint(value.as<unsigned long>());
+	} else if (value.is<double>()) {
+		writer.writeDouble(value.as<double>());
+	} else {
+		writer.writeNil();
+	}
 }
 
+void BleSerial_packJson(MsgPackWriter &writer, JsonObject &jo)
+{
+	writer.writeMap(jo.size());
+	for (JsonPair &pair : jo) {
+		writer.writeString(pair.key);
+		BleSerial_packJson(writer, pair.value);
+	}
+}
+
+void BleSerial_packJson(MsgPackWriter &writer, JsonArray &ja)
+{
+	writer.writeArray(ja.size());
+	for (JsonVariant &value : ja)
+		BleSerial_packJson(writer, value);
+}
+
+/**
+ * Send a reply, framed if the request was framed. The reply is MessagePack
+ * if the request was, JSON if the request was JSON or the reply does not fit.
+ */
+void BleSerial_sendJson(JsonObject &jo)
+{
+	if (ble_reply_request != NULL && ble_reply_request->hasId)
+		jo["id"] = ble_reply_request->id;
+	uint8_t type = BLE_FRAME_JSON;
+	if (ble_reply_request != NULL && ble_reply_request->msgpack) {
+		MsgPackWriter writer(ble_write_buffer, sizeof(ble_write_buffer));
+		BleSerial_packJson(writer, jo);
+		if (writer.overflowed() == false) {
+			type = BLE_FRAME_MSGPACK;
+			ble_write_count = writer.size();
+		}
+	}
+	if (type == BLE_FRAME_JSON) {
+		ble_write_string = ""; jo.printTo(ble_write_string);
+		ble_write_count = ble_write_string.length();
+		BLE_LOGD("json", "ws %s", ble_write_string.c_str());
+		memcpy(ble_write_buffer, (void*)&ble_write_string[0], ble_write_count);
+	}
+	ble_tx_codec.reset();
+	ble_tx_codec.apply(ble_write_buffer, ble_write_count);
+	if (ble_reply_request != NULL && ble_reply_request->framed) {
+		uint8_t header[BLE_FRAME_HEADER_SIZE];
+		BleFrameHeader h = { type, ble_reply_request->sequence, ble_write_count };
+		BleFrame_encodeHeader(header, h);
+		BleSerialSpan spans[] = {
+			{ header, sizeof(header) },
+			{ ble_write_buffer, ble_write_count },
+		};
+		BleSerial_writev(spans, 2);
+	} else {
+		BleSerial_write(ble_write_buffer, ble_write_count);
+	}
+}
+
+/** Text of one key, string or number while parsing a request */
+char ble_json_text[64];
+
+/**
+ * BleRequestReader
+ * Source of the request parser, reads out of the receive buffer and
+ * decodes on the way. A framed request is taken in blocks, its length
+ * is known; an unframed one byte by byte, the next request may follow it.
+ */
+typedef struct BleRequestReader {
+	bool framed;
+	size_t remaining; // payload bytes left of a framed request, block included
+	uint32_t deadline; // millis() when waiting for the rest gives up
+	uint8_t block[64]; // decoded bytes of a framed request
+	uint8_t blockLength;
+	uint8_t blockPosition;
+} BleRequestReader;
+
+int BleRequestReader_read(void *context)
+{
+	BleRequestReader *reader = (BleRequestReader*)context;
+	if (reader->blockPosition < reader->blockLength) {
+		reader->remaining--;
+		return reader->block[reader->blockPosition++];
+	}
+	if (reader->framed && reader->remaining == 0)
+		return -1;
+	// the rest of a request split across GATT writes is on its way
+	if (BleSerial_available() == 0 && BleSerial_waitAvailable(1, timeLeft(reader->deadline)) == false)
+		return -1;
+	if (reader->framed == false)
+		return ble_rx_codec.apply(BleSerial_read());
+	size_t length = reader->remaining < sizeof(reader->block) ? reader->remaining : sizeof(reader->block);
+	length = BleSerial_readBytes(reader->block, length);
+	ble_rx_codec.apply(reader->block, length);
+	reader->blockLength = length;
+	reader->blockPosition = 1;
+	reader->remaining--;
+	return reader->block[0];
+}
+
+/** Copy a string value, fails if it is not a string or does not fit */
+template <class Pull>
+bool BleRequest_copyText(Pull &json, JsonPull::Token token, char *out, size_t size)
+{
+	if (token != JsonPull::JSON_STRING || json.isTruncated() || json.getLength() >= size) {
+		json.skip(token);
+		return false;
+	}
+	strcpy(out, json.getText());
+	return true;
+}
+
+/**
+ * Parse one request object.
+ * Elements of a "value" array are written into the configurations as they
+ * are parsed, so the array needs no buffer of its own.
+ * Pull is JsonPull or MsgPackPull, both return the same tokens.
+ */
+template <class Pull>
+bool BleRequest_parse(Pull &json, BleRequest *request)
+{
+	memset(request, 0, sizeof(BleRequest));
+	request->depth = -1;
+	if (json.next() != JsonPull::JSON_BEGIN_OBJECT)
+		return false;
+
+	while (true) {
+		JsonPull::Token token = json.next();
+		if (token == JsonPull::JSON_END_OBJECT)
+			return true;
+		if (token != JsonPull::JSON_KEY)
+			return false;
+
+		// the key text is replaced by the value text, hash it first
+		uint32_t key = BleCommand_hash(json.getText());
+		token = json.next();
+		switch (key) {
+		case BLE_HASH("read"):
+		case BLE_HASH("write"):
+			// e.g. "read":"config_count" is the command read:config_count
+			if (token == JsonPull::JSON_STRING && json.isTruncated() == false && request->command == 0)
+				request->command = BleCommand_hash(json.getText(), BleCommand_hash(":", key));
+			else if (!json.skip(token))
+				return false;
+			break;
+		case BLE_HASH("erase"):
+		case BLE_HASH("reset"):
+			if (request->command == 0)
+				request->command = BleCommand_hash(":", key);
+			if (!json.skip(token))
+				return false;
+			break;
+		case BLE_HASH("config_index"):
+			if (token == JsonPull::JSON_NUMBER)
+				request->config_index = atoi(json.getText());
+			else if (!json.skip(token))
+				return false;
+			break;
+		case BLE_HASH("fileName"):
+			request->hasFileName = BleRequest_copyText(json, token, request->fileName, sizeof(request->fileName));
+			break;
+		case BLE_HASH("fileSize"):
+			if (token == JsonPull::JSON_NUMBER) {
+				request->fileSize = strtoul(json.getText(), NULL, 10);
+				request->hasFileSize = true;
+			} else if (!json.skip(token)) {
+				return false;
+			}
+			break;
+		case BLE_HASH("fileCRC"):
+			if (token == JsonPull::JSON_NUMBER) {
+				request->fileCRC = strtoul(json.getText(), NULL, 10);
+				request->hasFileCRC = true;
+			} else if (!json.skip(token)) {
+				return false;
+			}
+			break;
+		case BLE_HASH("compression"):
+			request->hasCompression = true;
+			if (token == JsonPull::JSON_STRING) {
+				request->compressed = strcmp(json.getText(), "lzss") == 0;
+			} else if (!json.skip(token)) {
+				return false;
+			}
+			break;
+		case BLE_HASH("compressedSize"):
+			if (token == JsonPull::JSON_NUMBER) {
+				request->compressedSize = strtoul(json.getText(), NULL, 10);
+				request->hasCompressedSize = true;
+			} else if (!json.skip(token)) {
+				return false;
+			}
+			break;
+		case BLE_HASH("cursor"):
+			BleRequest_copyText(json, token, request->cursor, sizeof(request->cursor));
+			break;
+		case BLE_HASH("prefix"):
+			BleRequest_copyText(json, token, request->prefix, sizeof(request->prefix));
+			break;
+		case BLE_HASH("glob"):
+			BleRequest_copyText(json, token, request->glob, sizeof(request->glob));
+			break;
+		case BLE_HASH("pageSize"):
+			if (token == JsonPull::JSON_NUMBER) {
+				request->pageSize = atoi(json.getText());
+			} else if (!json.skip(token)) {
+				return false;
+			}
+			break;
+		case BLE_HASH("depth"):
+			if (token == JsonPull::JSON_NUMBER) {
+				request->depth = atoi(json.getText());
+			} else if (!json.skip(token)) {
+				return false;
+			}
+			break;
+		case BLE_HASH("id"):
+			if (token == JsonPull::JSON_NUMBER) {
+				request->id = strtoul(json.getText(), NULL, 10);
+				request->hasId = true;
+			} else if (!json.skip(token)) {
+				return false;
+			}
+			break;
+		case BLE_HASH("version"):
+			if (token == JsonPull::JSON_NUMBER) {
+				request->version = strtoul(json.getText(), NULL, 10);
+				request->hasVersion = true;
+			} else if (!json.skip(token)) {
+				return false;
+			}
+			break;
+		case BLE_HASH("schemaHash"):
+			if (token == JsonPull::JSON_NUMBER) {
+				request->schemaHash = strtoul(json.getText(), NULL, 10);
+				request->hasSchemaHash = true;
+			} else if (!json.skip(token)) {
+				return false;
+			}
+			break;
+		case BLE_HASH("clear"):
+			request->clear = token == JsonPull::JSON_TRUE;
+			if (!json.skip(token))
+				return false;
+			break;
+		case BLE_HASH("chunked"):
+			request->chunked = token == JsonPull::JSON_TRUE;
+			if (!json.skip(token))
+				return false;
+			break;
+		case BLE_HASH("resume"):
+			request->resume = token == JsonPull::JSON_TRUE;
+			if (!json.skip(token))
+				return false;
+			break;
+		case BLE_HASH("value"):
+			if (token == JsonPull::JSON_BEGIN_OBJECT) {
+				// {"name":"value",...} writes only the named configurations
+				while ((token = json.next()) != JsonPull::JSON_END_OBJECT) {
+					if (token != JsonPull::JSON_KEY)
+						return false;
+					// look the name up before its value replaces the text
+					int id = json.isTruncated() ? rgc_array_count : RGConfig_find(json.getText());
+					token = json.next();
+					if ((token == JsonPull::JSON_STRING || token == JsonPull::JSON_NUMBER) && id < rgc_array_count) {
+						RGConfig_fromString(id, json.getText());
+						request->valuesApplied = true;
+					} else if (!json.skip(token)) {
+						return false;
+					}
+				}
+				break;
+			}
+			if (token != JsonPull::JSON_BEGIN_ARRAY) {
+				if (!json.skip(token))
+					return false;
+				break;
+			}
+			for (int i = 0; (token = json.next()) != JsonPull::JSON_END_ARRAY; i++) {
+				if ((token == JsonPull::JSON_STRING || token == JsonPull::JSON_NUMBER) && i < rgc_array_count) {
+					RGConfig_fromString(i, json.getText());
+					request->valuesApplied = true;
+				} else if (!json.skip(token)) {
+					return false;
+				}
+			}
+			break;
+		default:
+			if (!json.skip(token))
+				return false;
+			break;
+		}
+	}
+}
 
 /* You only need to format SPIFFS the first time you run a
    test or else use the SPIFFS plugin to create a partition
@@ -440,75 +870,163 @@ bool spiffs_mount = false;
 
 extern size_t transmitBufferLength;
 
-CRC32 crc;
+Crc32 crc;
 
-void listDirToJson(fs::FS &fs, const char * dirname, uint8_t levels, JsonArray &jaFileName, JsonArray &jaFileSize){
-    Serial.printf("Listing directory: %s\r\n", dirname);
+DirIndex ble_dir_index;
 
-    File root = fs.open(dirname);
-    if(!root){
-        Serial.println("- failed to open directory");
+/** Epoch of the SPIFFS contents the file metadata cache belongs to, not listed */
+#define FILE_META_EPOCH_PATH "/.filemeta"
+
+/** Scan the root once, afterwards the file functions keep ble_dir_index up to date */
+void buildDirIndex(fs::FS &fs){
+	ble_dir_index.clear();
+    File root = fs.open("/");
+    if(!root || !root.isDirectory()){
+        BLE_LOGE("file", "failed to open directory");
         return;
     }
-    if(!root.isDirectory()){
-        Serial.println(" - not a directory");
-        return;
+    File file = root.openNextFile();
+    while(file){
+		ble_dir_index.set(file.name(), file.size());
+        file = root.openNextFile();
     }
+    BLE_LOGI("file", "Indexed %u files, %u bytes", ble_dir_index.getCount(), ble_dir_index.getUsedBytes(NULL));
+}
+
+/** Entries of one listDir reply, bounded by what fits into jsonBuffer */
+const int ble_list_page_size = 8;
 
+/**
+ * BleListPage
+ * The first entries sorted by name after the cursor that pass the filters.
+ * more is set once a further entry passes, its cursor is the last name.
+ */
+typedef struct BleListPage {
+	DirIndex::Entry entries[ble_list_page_size];
+	int count;
+	int size;
+	bool more;
+} BleListPage;
+
+/** Match name against a pattern of literal characters, * and ? */
+bool globMatch(const char *pattern, const char *name)
+{
+	const char *star = NULL;
+	const char *resume = NULL;
+	while (*name) {
+		if (*pattern == '?' || *pattern == *name) {
+			pattern++;
+			name++;
+		} else if (*pattern == '*') {
+			star = pattern++;
+			resume = name;
+		} else if (star != NULL) {
+			pattern = star + 1;
+			name = ++resume;
+		} else {
+			return false;
+		}
+	}
+	while (*pattern == '*')
+		pattern++;
+	return *pattern == '\0';
+}
+
+bool listDirAccepts(BleRequest *request, const char *name)
+{
+	if (strcmp(name[0] == '/' ? name + 1 : name, FILE_META_EPOCH_PATH + 1) == 0)
+		return false;
+	if (request->cursor[0] != '\0' && strcmp(name, request->cursor) <= 0)
+		return false;
+	if (strncmp(name, request->prefix, strlen(request->prefix)) != 0)
+		return false;
+	if (request->glob[0] != '\0' && globMatch(request->glob, name) == false)
+		return false;
+	if (request->depth >= 0) {
+		int levels = 0;
+		for (const char *c = name + strlen(request->prefix); *c; c++) {
+			if (*c == '/')
+				levels++;
+		}
+		if (levels > request->depth)
+			return false;
+	}
+	return true;
+}
+
+/** Keep name if it belongs into the page, entries are offered in any order */
+void listDirOffer(BleListPage *page, const char *name, size_t size)
+{
+	int i = page->count;
+	while (i > 0 && strcmp(page->entries[i - 1].name, name) > 0)
+		i--;
+	if (i == page->size) {
+		page->more = true;
+		return;
+	}
+	if (page->count == page->size) {
+		page->more = true;
+		page->count--;
+	}
+	memmove(&page->entries[i + 1], &page->entries[i], (page->count - i) * sizeof(DirIndex::Entry));
+	strncpy(page->entries[i].name, name, sizeof(page->entries[i].name) - 1);
+	page->entries[i].name[sizeof(page->entries[i].name) - 1] = '\0';
+	page->entries[i].size = size;
+	page->count++;
+}
+
+void listDirPage(fs::FS &fs, BleRequest *request, BleListPage *page){
+	page->count = 0;
+	page->more = false;
+	page->size = request->pageSize;
+	if (page->size <= 0 || page->size > ble_list_page_size)
+		page->size = ble_list_page_size;
+
+	if (ble_dir_index.isComplete()) {
+		// sorted already, start right after the cursor and stop after one page
+		for (size_t i = ble_dir_index.upperBound(request->cursor); i < ble_dir_index.getCount() && page->more == false; i++) {
+			const DirIndex::Entry &entry = ble_dir_index.at(i);
+			if (listDirAccepts(request, entry.name))
+				listDirOffer(page, entry.name, entry.size);
+		}
+		return;
+	}
+
+    File root = fs.open("/");
+    if(!root || !root.isDirectory()){
+        BLE_LOGE("file", "failed to open directory");
+        return;
+    }
     File file = root.openNextFile();
     while(file){
-        if(file.isDirectory()){
-            Serial.print("  DIR : ");
-            Serial.println(file.name());
-			/*
-            // support only 1 level.
-			if(levels){
-                listDir(fs, file.path(), levels -1);
-            }
-			*/
-        } else {
-            Serial.print("  FILE: ");
-            Serial.print(file.name());
-            Serial.print("\tSIZE: ");
-            Serial.println(file.size());
-        }
-		jaFileName.add<String>(file.name());
-		jaFileSize.add<size_t>(file.size());
+		if (listDirAccepts(request, file.name()))
+			listDirOffer(page, file.name(), file.size());
         file = root.openNextFile();
     }
 }
 
 bool listDirSize(fs::FS &fs, const char * dirname, const char *filename_to_except, size_t *size){
-    Serial.printf("Listing directory: %s\r\n", dirname);
+	if (ble_dir_index.isComplete()) {
+		if (size != NULL)
+			*size = ble_dir_index.getUsedBytes(filename_to_except);
+		return true;
+	}
+
+    BLE_LOGD("file", "Listing directory: %s", dirname);
 
     File root = fs.open(dirname);
     if(!root){
-        Serial.println("- failed to open directory");
+        BLE_LOGE("file", "failed to open directory");
         return false;
     }
     if(!root.isDirectory()){
-        Serial.println(" - not a directory");
+        BLE_LOGE("file", "not a directory");
         return false;
     }
 
 	size_t s = 0;
     File file = root.openNextFile();
     while(file){
-        if(file.isDirectory()){
-            Serial.print("  DIR : ");
-            Serial.println(file.name());
-			/*
-            // support only 1 level.
-			if(levels){
-                listDir(fs, file.path(), levels -1);
-            }
-			*/
-        } else {			
-            Serial.print("  FILE: ");
-            Serial.print(file.name());
-            Serial.print("\tSIZE: ");
-            Serial.println(file.size());
-        }
 		if (filename_to_except != NULL && strcmp(file.name(), filename_to_except) == 0) {
 	        file = root.openNextFile();
 			continue;		
@@ -522,11 +1040,11 @@ bool listDirSize(fs::FS &fs, const char * dirname, const char *filename_to_excep
 }
 
 bool getFileSize(fs::FS &fs, const char * path, size_t *size){
-    Serial.printf("Getting file size: %s\r\n", path);
+    BLE_LOGI("file", "Getting file size: %s", path);
 
     File file = fs.open(path);
     if(!file || file.isDirectory()){
-        Serial.println("- failed to open file for reading");
+        BLE_LOGE("file", "failed to open file for reading");
         return false;
     }
 	if (size != NULL) {
@@ -536,651 +1054,1127 @@ bool getFileSize(fs::FS &fs, const char * path, size_t *size){
 	return true;
 }
 
-bool getFileCRC(fs::FS &fs, const char * path, uint32_t *checksum){
-    Serial.printf("Getting file crc: %s\r\n", path);
+/**
+ * FileMeta
+ * Size and CRC of a file, cached in preferences so a download handshake
+ * does not read the whole file, not even after a reboot. Every write
+ * through writeFile, renameFile, deleteFile, appendFile and uploads keeps
+ * it up to date. A file changed without the firmware, e.g. by flashing a
+ * new SPIFFS image, may keep its size; fileMetaMount drops the cache then.
+ */
+typedef struct FileMeta {
+	char name[33];
+	uint32_t size;
+	uint32_t crc;
+	uint32_t generation; // changes on every write of the file
+} FileMeta;
+
+/**
+ * Generation of the next cached file. Random at boot like rgc_version,
+ * so a generation seen before a reboot does not come back after it.
+ */
+uint32_t ble_file_generation = 0;
+
+/** Preferences keys are limited to 15 characters, use a hash of the path */
+static void fileMetaKey(const char *path, char *key)
+{
+	sprintf(key, "f%08x", Crc32::calculate((const uint8_t*)path, strlen(path)));
+}
+
+bool fileMetaGet(const char *path, FileMeta *meta)
+{
+	char key[16];
+	fileMetaKey(path, key);
+	Preferences p;
+	p.begin("filemeta", true);
+	size_t length = p.getBytes(key, meta, sizeof(FileMeta));
+	p.end();
+	return length == sizeof(FileMeta) && strcmp(meta->name, path) == 0;
+}
+
+/** Cache size and crc of path with a new generation, returned in generation if given */
+void fileMetaPut(const char *path, uint32_t size, uint32_t crc, uint32_t *generation)
+{
+	FileMeta meta;
+	if (strlen(path) >= sizeof(meta.name))
+		return;
+	memset(&meta, 0, sizeof(meta));
+	strcpy(meta.name, path);
+	meta.size = size;
+	meta.crc = crc;
+	meta.generation = ble_file_generation++;
+	if (generation != NULL)
+		*generation = meta.generation;
+
+	char key[16];
+	fileMetaKey(path, key);
+	Preferences p;
+	p.begin("filemeta", false);
+	p.putBytes(key, &meta, sizeof(meta));
+	p.end();
+}
+
+void fileMetaRemove(const char *path)
+{
+	char key[16];
+	fileMetaKey(path, key);
+	Preferences p;
+	p.begin("filemeta", false);
+	p.remove(key);
+	p.end();
+}
+
+/**
+ * Check that the cache belongs to the mounted SPIFFS, called once after
+ * mounting. FILE_META_EPOCH_PATH and the preferences hold the same random
+ * epoch; a SPIFFS flashed or formatted since, or erased preferences, do
+ * not, and only then the cache is cleared and a new epoch written.
+ */
+void fileMetaMount(fs::FS &fs)
+{
+	ble_file_generation = esp_random();
+	uint32_t epoch = 0;
+	File file = fs.open(FILE_META_EPOCH_PATH);
+	if (file && !file.isDirectory() && file.read((uint8_t*)&epoch, sizeof(epoch)) != sizeof(epoch))
+		epoch = 0;
+	file.close();
+
+	Preferences p;
+	p.begin("filemeta", false);
+	if (epoch == 0 || p.getUInt("epoch", 0) != epoch) {
+		BLE_LOGI("file", "file metadata cache is stale, clearing it");
+		p.clear();
+		do {
+			epoch = esp_random();
+		} while (epoch == 0);
+		file = fs.open(FILE_META_EPOCH_PATH, FILE_WRITE);
+		if (file && file.write((const uint8_t*)&epoch, sizeof(epoch)) == sizeof(epoch)) {
+			p.putUInt("epoch", epoch);
+			ble_dir_index.set(FILE_META_EPOCH_PATH, sizeof(epoch));
+		}
+		file.close();
+	}
+	p.end();
+}
+
+/**
+ * Size, CRC and generation of a file with a single open.
+ * The CRC comes from the metadata cache when the cached size still matches,
+ * otherwise it is computed in one pass and cached.
+ */
+bool getFileInfo(fs::FS &fs, const char * path, size_t *size, uint32_t *checksum, uint32_t *generation){
+    BLE_LOGI("file", "Getting file info: %s", path);
 
     File file = fs.open(path);
     if(!file || file.isDirectory()){
-        Serial.println("- failed to open file for reading");
+        BLE_LOGE("file", "failed to open file for reading");
         return false;
     }
-
-	char c;
-	crc.reset();
-    while(file.available()){
-		c = file.read();
-		crc.update(c);
-    }
-    file.close();
+	size_t fileSize = file.size();
+	FileMeta meta;
+	if (fileMetaGet(path, &meta) && meta.size == fileSize) {
+		file.close();
+	} else {
+		// read in blocks, single byte reads through the VFS are slow
+		crc.reset();
+		size_t length;
+		while((length = file.read(ble_read_buffer, BUFFER_SIZE)) > 0){
+			crc.update(ble_read_buffer, length);
+		}
+		file.close();
+		meta.crc = crc.finalize();
+		fileMetaPut(path, fileSize, meta.crc, &meta.generation);
+	}
+	if (size != NULL)
+		*size = fileSize;
 	if (checksum != NULL)
-		*checksum = crc.finalize();
+		*checksum = meta.crc;
+	if (generation != NULL)
+		*generation = meta.generation;
 	return true;
 }
 
-bool readFile(fs::FS &fs, const char * path){
-    Serial.printf("Reading file: %s\r\n", path);
+/** Send the content of path, as an LZSS stream if compressed */
+bool readFile(fs::FS &fs, const char * path, bool compressed){
+    BLE_LOGI("file", "Reading file: %s", path);
 
     File file = fs.open(path);
     if(!file || file.isDirectory()){
-        Serial.println("- failed to open file for reading");
+        BLE_LOGE("file", "failed to open file for reading");
         return false;
     }
-	uint32_t timer100ms = millis() / 100;
+	if (compressed)
+		ble_lzss_encoder.reset();
+	bool timedOut = false;
 	int size = file.available();
 	while(size > 0){
-		timer100ms = millis() / 100;		
-		int payload = 256;
+		uint32_t deadline = millis() + ble_file_timeout_ms;
+		int payload = compressed ? LZSS_BLOCK : 256;
 		uint32_t bytes_to_read;
 		if (size - payload >= 0) {
 			bytes_to_read = payload;
 		} else {
 			bytes_to_read = size;
 		}
-		Serial.print("r");
-		Serial.println(bytes_to_read);
-		file.read(ble_write_buffer, bytes_to_read);
-		BleSerial_write(ble_write_buffer, bytes_to_read); // BleSerial_flush inside
+		BLE_LOGV("file", "r%u", bytes_to_read);
+		if (compressed) {
+			file.read(ble_read_buffer, bytes_to_read);
+			size_t length = ble_lzss_encoder.compress(ble_read_buffer, bytes_to_read, ble_write_buffer);
+			if (bytes_to_read == size)
+				length += ble_lzss_encoder.finish(&ble_write_buffer[length]);
+			BleSerial_queue(ble_write_buffer, length);
+		} else {
+			file.read(ble_write_buffer, bytes_to_read);
+			BleSerial_queue(ble_write_buffer, bytes_to_read); // waits only for a free TX frame
+		}
 		size -= bytes_to_read;
-		delay(1);
-		if ((millis() / 100) - timer100ms > ble_file_timeout_100ms) {
+		if (timeLeft(deadline) == 0) {
+			timedOut = true;
 			break;
 		}
 	}
     file.close();
-	if ((millis() / 100) - timer100ms > ble_file_timeout_100ms) {
-		Serial.println("timeout");
+	// every frame but the last was sent full
+	BleSerial_flush();
+	if (timedOut) {
+		BLE_LOGW("file", "timeout");
         return false;
 	}
 	return true;
 }
 
-bool writeFile(fs::FS &fs, const char * path, int size){
-    Serial.printf("Writing file: %s\r\n", path);
+/** Send a new credit once the client could send this many more bytes */
+const size_t ble_file_credit_step = 1024;
+
+/**
+ * Tell the uploading client how many bytes of the file it may have sent in total.
+ * The credit is the number of bytes already taken out of the receive buffer
+ * plus the buffer capacity, so the client never overruns the buffer.
+ */
+void sendWriteFileCredit(size_t credit)
+{
+	StaticJsonBuffer<96> creditBuffer;
+	JsonObject& jo = creditBuffer.createObject();
+	jo["write"] = "file";
+	jo["credit"] = credit;
+	BleSerial_sendJson(jo);
+}
+
+/**
+ * Receive size bytes into path, checksum is the CRC of what was received.
+ * With a compressedSize the client sends that many bytes of LZSS stream,
+ * which are decoded on the way, 0 if the content is sent raw.
+ */
+bool writeFile(fs::FS &fs, const char * path, int size, size_t compressedSize, uint32_t *checksum){
+    BLE_LOGI("file", "Writing file: %s", path);
 
     File file = fs.open(path, FILE_WRITE);
     if(!file){
-        Serial.println("- failed to open file for writing");
+        BLE_LOGE("file", "failed to open file for writing");
         return false;
     }
 
-	uint32_t timer100ms = millis() / 100;
-    while(size > 0) {
-		if (BleSerial_available() > 0) { 
-			timer100ms = millis() / 100;		
+	fileMetaRemove(path);
+	crc.reset();
+	if (compressedSize > 0)
+		ble_lzss_decoder.reset();
+	// the decoded data goes behind the compressed block in ble_read_buffer
+	uint8_t *decoded = &ble_read_buffer[LZSS_BLOCK];
+	int remaining = compressedSize > 0 ? compressedSize : size;
+	uint32_t dropped = BleSerial_droppedBytes();
+	size_t received = 0;
+	size_t written = 0;
+	size_t credit = BleSerial_free();
+	uint32_t deadline = millis() + ble_file_timeout_ms;
+	bool timedOut = false;
+    while(remaining > 0) {
+		// sleeps until onWrite stores the next bytes
+		if (BleSerial_waitAvailable(1, timeLeft(deadline))) { 
+			deadline = millis() + ble_file_timeout_ms;
 			uint32_t bytes_to_write;
-			if (size - BleSerial_available() >= 0) {
+			if (remaining - BleSerial_available() >= 0) {
 				bytes_to_write = BleSerial_available();
 			} else {
-				bytes_to_write = size;
+				bytes_to_write = remaining;
 			}
+			if (compressedSize > 0 && bytes_to_write > LZSS_BLOCK)
+				bytes_to_write = LZSS_BLOCK;
 			BleSerial_readBytes(ble_read_buffer, bytes_to_write);
-			Serial.print("w");
-			Serial.println(bytes_to_write);
-			file.write(ble_read_buffer, bytes_to_write);
-			size -= bytes_to_write;
+			BLE_LOGV("file", "w%u", bytes_to_write);
+			if (compressedSize > 0) {
+				size_t used = 0;
+				while (used < bytes_to_write && written < (size_t)size) {
+					size_t consumed;
+					size_t length = ble_lzss_decoder.decompress(&ble_read_buffer[used], bytes_to_write - used, &consumed,
+						decoded, min((size_t)(BUFFER_SIZE - LZSS_BLOCK), size - written));
+					file.write(decoded, length);
+					crc.update(decoded, length);
+					written += length;
+					used += consumed;
+				}
+			} else {
+				file.write(ble_read_buffer, bytes_to_write);
+				crc.update(ble_read_buffer, bytes_to_write);
+				written += bytes_to_write;
+			}
+			remaining -= bytes_to_write;
+			received += bytes_to_write;
+
+			if (remaining > 0 && received + BleSerial_capacity() - credit >= ble_file_credit_step) {
+				credit = received + BleSerial_capacity();
+				sendWriteFileCredit(credit);
+			}
+		}
+		if (BleSerial_droppedBytes() != dropped) {
+			// the client outran the receive buffer, the file is corrupted anyway
+			BLE_LOGW("file", "overflow");
+			break;
 		}
-		if ((millis() / 100) - timer100ms > ble_file_timeout_100ms) {
+		if (timeLeft(deadline) == 0) {
+			timedOut = true;
 			break;
 		}
 		esp_task_wdt_reset();
     }
     file.close();
-	if ((millis() / 100) - timer100ms > ble_file_timeout_100ms) {
-		Serial.println("timeout");
+	ble_dir_index.set(path, written);
+	if (BleSerial_droppedBytes() != dropped) {
+		return false;
+	}
+	if (timedOut) {
+		BLE_LOGW("file", "timeout");
         return false;
 	}
+	if (written != (size_t)size) {
+		BLE_LOGW("file", "stream does not match the file size");
+		return false;
+	}
+	if (checksum != NULL)
+		*checksum = crc.finalize();
 	return true;
 }
 
 void appendFile(fs::FS &fs, const char * path, const char * message){
-    Serial.printf("Appending to file: %s\r\n", path);
+    BLE_LOGI("file", "Appending to file: %s", path);
 
+    fileMetaRemove(path);
     File file = fs.open(path, FILE_APPEND);
     if(!file){
-        Serial.println("- failed to open file for appending");
+        BLE_LOGE("file", "failed to open file for appending");
         return;
     }
     if(file.print(message)){
-        Serial.println("- message appended");
+        BLE_LOGD("file", "message appended");
     } else {
-        Serial.println("- append failed");
+        BLE_LOGE("file", "append failed");
     }
+    ble_dir_index.set(path, file.size());
     file.close();
 }
 
 void renameFile(fs::FS &fs, const char * path1, const char * path2){
-    Serial.printf("Renaming file %s to %s\r\n", path1, path2);
+    BLE_LOGI("file", "Renaming file %s to %s", path1, path2);
+    FileMeta meta;
+    bool cached = fileMetaGet(path1, &meta);
+    fileMetaRemove(path1);
+    fileMetaRemove(path2);
     if (fs.rename(path1, path2)) {
-        Serial.println("- file renamed");
+        ble_dir_index.rename(path1, path2);
+        if (cached)
+            fileMetaPut(path2, meta.size, meta.crc, NULL);
+        BLE_LOGD("file", "file renamed");
     } else {
-        Serial.println("- rename failed");
+        BLE_LOGE("file", "rename failed");
     }
 }
 
 void deleteFile(fs::FS &fs, const char * path){
-    Serial.printf("Deleting file: %s\r\n", path);
+    BLE_LOGI("file", "Deleting file: %s", path);
+    fileMetaRemove(path);
     if(fs.remove(path)){
-        Serial.println("- file deleted");
+        ble_dir_index.remove(path);
+        BLE_LOGD("file", "file deleted");
     } else {
-        Serial.println("- delete failed");
+        BLE_LOGE("file", "delete failed");
     }
 }
 
+void handleReadConfigCount(BleRequest *request)
+{
+	// Json object for outgoing data 
+	JsonObject& jo = jsonBuffer.createObject();
+	jo["read"] = "config_count";
+	jo["config_count"] = rgc_array_count;
+	jo["schemaHash"] = rgc_schema_hash;
+
+	BleSerial_sendJson(jo);
+	jsonBuffer.clear();
+}
 
-// Task for reading BLE Serial
-void ReadBLESerialTask(void *e)
+/** Room one descriptor takes in a JSON buffer, none of its strings are copied */
+#define RG_CONFIG_DESC_JSON_SIZE (JSON_OBJECT_SIZE(8) + JSON_ARRAY_SIZE(8))
+/** Reply bytes kept free for the frame header and the id */
+#define RG_CONFIG_REPLY_RESERVE (BLE_FRAME_HEADER_SIZE + 16)
+
+/**
+ * Sends the descriptors from config_index on, as many per reply as fit
+ * into one notification, but at least one. One reply per call.
+ */
+void continueReadConfigs(BleRequest *request)
 {
-    while (true)
-    {
-		if (ble_timer10ms > 0)
-            ble_timer10ms--;
-        if (ble_timer10ms == 0) {
-            ble_timer10ms = 10;
-
-            // 10ms tick
-            if (ble_state_timer100ms > 0)
-                ble_state_timer100ms--;
-        }
-        // 100ms tick
-        /*
-        if (ble_state_timer100ms > 0)
-            ble_state_timer100ms--;
-        */
-        if (BleSerial_available())
-        {
-            size_t count = BleSerial_readBytes(ble_read_buffer, BUFFER_SIZE);
-			if (count == 0) {
-				continue;
-			}
-			BleSerial_decode(ble_read_buffer, count);
-			ble_read_buffer[count] = '\0';
-			ble_read_string = String((char*)ble_read_buffer);
-			Serial.print("rs ");
-			Serial.println(ble_read_string);
-			
-        }
-		switch(ble_state) {
-		case 0:
+	StaticJsonBuffer<1200> configsBuffer;
+	JsonObject& jo = configsBuffer.createObject();
+	jo["read"] = "configs";
+	jo["schemaHash"] = rgc_schema_hash;
+	jo["config_count"] = rgc_array_count;
+	jo["config_index"] = request->config_index;
+	jo["more"] = true;
+	JsonArray& ja = jo.createNestedArray("configs");
+
+	size_t frameSize = BleSerial_frameSize();
+	size_t budget = frameSize > RG_CONFIG_REPLY_RESERVE ? frameSize - RG_CONFIG_REPLY_RESERVE : 0;
+	int index = request->config_index;
+	while (index < rgc_array_count) {
+		if (ja.size() > 0 && configsBuffer.capacity() - configsBuffer.size() < RG_CONFIG_DESC_JSON_SIZE)
+			break;
+		JsonObject& joConfig = ja.createNestedObject();
+		RGConfig_toJson(joConfig, index, false);
+		if (ja.size() > 1 && jo.measureLength() > budget) {
+			ja.remove(ja.size() - 1);
 			break;
+		}
+		index++;
+	}
+	jo["more"] = index < rgc_array_count;
 
-		case 100: // ready
-		{
-			if (ble_read_string == "")
-				break;
+	BleSerial_sendJson(jo);
+	request->config_index = index;
+	if (index >= rgc_array_count)
+		request->continuation = NULL;
+}
 
-			JsonObject& jo = jsonBuffer.parseObject(ble_read_string);
-			if (jo.success() == false) 
-				break;
+/** Descriptors of all configurations in one request, read:value gives the values */
+void handleReadConfigs(BleRequest *request)
+{
+	if (request->hasSchemaHash && request->schemaHash == rgc_schema_hash) {
+		// the client has cached these descriptors
+		JsonObject& jo = jsonBuffer.createObject();
+		jo["read"] = "configs";
+		jo["schemaHash"] = rgc_schema_hash;
+		jo["config_count"] = rgc_array_count;
+		jo["notModified"] = true;
+		BleSerial_sendJson(jo);
+		jsonBuffer.clear();
+		return;
+	}
+	if (request->config_index < 0 || request->config_index > rgc_array_count)
+		request->config_index = 0;
+	continueReadConfigs(request);
+	if (request->config_index < rgc_array_count)
+		request->continuation = continueReadConfigs;
+}
 
-			if (jo.containsKey("read"))
-			{
-				if (jo["read"].as<String>() == "config_count")
-				{
-					ble_state = 110;
-					break;		
-				}
-				if (jo["read"].as<String>() == "config_index")
-				{
-					ble_config_index = jo["config_index"].as<int>();
-					ble_state = 120;
-					break;		
-				}
-				if (jo["read"].as<String>() == "value")
-				{
-					ble_state = 130;
-					break;		
-				}
-				if (jo["read"].as<String>() == "filesystem")
-				{
-					ble_state = 140;
-					break;		
-				}
-				if (jo["read"].as<String>() == "listDir")
-				{
-					ble_state = 150;
-					break;		
-				}
-				if (jo["read"].as<String>() == "file")
-				{
-					ble_state = 160;
-					break;		
-				}
-			}
-			if (jo.containsKey("write"))
-			{
-				if (jo["write"].as<String>() == "value")
-				{
-					ble_state = 230;
-					break;		
-				}
-				if (jo["write"].as<String>() == "file")
-				{
-					ble_state = 260;
-					break;		
-				}
-			}
-			if (jo.containsKey("erase"))
-			{
-				ble_state = 300;
-				break;		
-			}
-			if (jo.containsKey("reset"))
-			{
-				ble_state = 310;
-				break;		
-			}
-			
-			break;
-		}
+void handleReadConfigIndex(BleRequest *request)
+{
+	// Json object for outgoing data 
+	JsonObject& jo = jsonBuffer.createObject();
+	jo["read"] = "config_index";
+	if (request->config_index < 0 || request->config_index >= rgc_array_count) {
+		jo["config_index"] = -1;
+	} else {
+		jo["config_index"] = request->config_index;
+		RGConfig_toJson(jo, request->config_index);
+	}
 
-		case 110: // read config_count
-		{
-			// Json object for outgoing data 
-			JsonObject& jo = jsonBuffer.createObject();
-			jo["read"] = "config_count";
-			jo["config_count"] = rgc_array_count;
-
-			ble_read_string = "";
-			ble_write_string = ""; jo.printTo(ble_write_string);
-			jsonBuffer.clear();
-			ble_write_count = ble_write_string.length();
-			Serial.print("ws ");
-			Serial.println(ble_write_string);			
-			memcpy(ble_write_buffer, (void*)&ble_write_string[0], ble_write_string.length());
-			BleSerial_encode(ble_write_buffer, ble_write_count);
-			BleSerial_write(ble_write_buffer, ble_write_count);
-			ble_state = 100;
-			break;
+	BleSerial_sendJson(jo);
+	jsonBuffer.clear();
+}
+
+void handleReadValue(BleRequest *request)
+{
+	// Json object for outgoing data 
+	JsonObject& jo = jsonBuffer.createObject();
+	jo["read"] = "value";
+	jo["version"] = rgc_version;
+	if (request->hasVersion && request->version == rgc_version) {
+		// the client has these values already
+		jo["notModified"] = true;
+		BleSerial_sendJson(jo);
+		jsonBuffer.clear();
+		return;
+	}
+	JsonArray& ja = jo.createNestedArray("value");
+	for(int i = 0; i < rgc_array_count; i++) {
+		RGConfig_toJsonArrayValue(ja, i, request->msgpack);
+	}
+
+	BleSerial_sendJson(jo);
+	jsonBuffer.clear();
+}
+
+void handleReadFilesystem(BleRequest *request)
+{
+	// Json object for outgoing data 
+	JsonObject& jo = jsonBuffer.createObject();
+	jo["read"] = "filesystem";
+	if (spiffs_mount) {
+		jo["result"] = "ok";
+		size_t totalBytes;
+		totalBytes = SPIFFS.totalBytes() * 0.80; // filesystem use at least 20% of partition
+		jo["totalBytes"] = totalBytes;
+		size_t usedBytes; // it means entire size of all files
+		listDirSize(SPIFFS, "/", NULL, &usedBytes); 
+		jo["usedBytes"] = usedBytes;
+	} else {
+		jo["result"] = "failed not mount";
+	}
+
+	BleSerial_sendJson(jo);
+	jsonBuffer.clear();
+}
+
+void handleReadListDir(BleRequest *request)
+{
+	// Json object for outgoing data 
+	JsonObject& jo = jsonBuffer.createObject();
+	jo["read"] = "listDir";
+	if (spiffs_mount) {
+		jo["result"] = "ok";
+		BleListPage page;
+		listDirPage(SPIFFS, request, &page);
+		JsonArray& jaFileName = jo.createNestedArray("listDirFileName");
+		JsonArray& jaFileSize = jo.createNestedArray("listDirFileSize");
+		for (int i = 0; i < page.count; i++) {
+			jaFileName.add((const char*)page.entries[i].name); // not copied into jsonBuffer
+			jaFileSize.add<size_t>(page.entries[i].size);
 		}
+		// the client asks again with this cursor for the next page
+		if (page.more)
+			jo["nextCursor"] = (const char*)page.entries[page.count - 1].name;
+	} else {
+		jo["result"] = "failed not mount";
+	}
+
+	BleSerial_sendJson(jo);
+	jsonBuffer.clear();
+}
 
-		case 120:
-		{
-			// Json object for outgoing data 
-			JsonObject& jo = jsonBuffer.createObject();
-			jo["read"] = "config_index";
-			if (ble_config_index >= rgc_array_count) {
-				jo["config_index"] = -1;
+void continueReadFile(BleRequest *request)
+{
+	readFile(SPIFFS, (char*)&ble_file_name[0], ble_file_compressed);
+	request->continuation = NULL;
+}
+
+void handleReadFile(BleRequest *request)
+{
+	jsonBuffer.clear();
+
+	JsonObject& joWrite = jsonBuffer.createObject();
+	joWrite["read"] = "file";
+	ble_file_name = "";
+	if (spiffs_mount) {
+		if (request->hasFileName) {
+			ble_file_name = request->fileName;
+			uint32_t generation;
+			if (getFileInfo(SPIFFS, (char*)&ble_file_name[0], &ble_file_size, &ble_file_crc, &generation)) {
+				joWrite["result"] = "ok";
+				joWrite["fileSize"] = ble_file_size;
+				joWrite["fileCRC"] = ble_file_crc;
+				joWrite["generation"] = generation;
+				// the content follows as an LZSS stream, fileSize and fileCRC stay those of the file
+				ble_file_compressed = request->compressed;
+				if (request->hasCompression)
+					joWrite["compression"] = ble_file_compressed ? "lzss" : "none";
 			} else {
-				jo["config_index"] = ble_config_index;
-				RGConfig* rgc = rgc_array[ble_config_index];
-				rgc->ToJson(jo);
+				joWrite["result"] = "failed file not exist";
 			}
-
-			ble_read_string = "";
-			ble_write_string = ""; jo.printTo(ble_write_string);
-			jsonBuffer.clear();
-			ble_write_count = ble_write_string.length();
-			Serial.print("ws ");
-			Serial.println(ble_write_string);			
-			memcpy(ble_write_buffer, (void*)&ble_write_string[0], ble_write_string.length());
-			BleSerial_encode(ble_write_buffer, ble_write_count);
-			BleSerial_write(ble_write_buffer, ble_write_count);
-			ble_state = 100;
-			break;
+		} else {
+			joWrite["result"] = "failed argument invalid";
 		}
-		break;
-		
-		case 130: // read value
-		{
-			// Json object for outgoing data 
-			JsonObject& jo = jsonBuffer.createObject();
-			jo["read"] = "value";
-			JsonArray& ja = jo.createNestedArray("value");
-			for(int i = 0; i < rgc_array_count; i++) {
-				RGConfig* rgc = rgc_array[i];
-				rgc->ToJsonArrayValue(ja);
-			}
+	} else {
+		joWrite["result"] = "failed not mount";
+	}
 
-			ble_read_string = "";
-			ble_write_string = ""; jo.printTo(ble_write_string);
-			jsonBuffer.clear();
-			ble_write_count = ble_write_string.length();
-			Serial.print("ws ");
-			Serial.println(ble_write_string);			
-			memcpy(ble_write_buffer, (void*)&ble_write_string[0], ble_write_string.length());
-			BleSerial_encode(ble_write_buffer, ble_write_count);
-			BleSerial_write(ble_write_buffer, ble_write_count);
-			ble_state = 100;
-			break;
+	BleSerial_sendJson(joWrite);
+	jsonBuffer.clear();
+	if (joWrite["result"] != "ok") {
+		return;
+	}
+	// give time android to get ready, other requests wait until the content is sent
+	request->wakeAt = millis() + 100;
+	request->continuation = continueReadFile;
+}
+
+void handleWriteValue(BleRequest *request)
+{
+	// the values were written into the configurations while parsing,
+	// only the ones that changed are saved
+	JsonObject& jo = jsonBuffer.createObject();
+	jo["write"] = "value";
+	esp_err_t err = saveConfigs(jo.createNestedArray("persisted"));
+	if (err == ESP_OK) {
+		jo["result"] = "ok";
+	} else {
+		BLE_LOGE("config", "saving configurations failed: %d", err);
+		jo["result"] = "failed save";
+	}
+	jo["version"] = rgc_version;
+
+	BleSerial_sendJson(jo);
+	jsonBuffer.clear();
+}
+
+void continueWriteFile(BleRequest *request)
+{
+	// Json object for outgoing data 
+	JsonObject& jo = jsonBuffer.createObject();
+	jo["write"] = "file";
+
+	uint32_t crc_value = 0;
+	if (writeFile(SPIFFS, (char*)&ble_file_name[0], ble_file_size, ble_file_compressed_size, &crc_value)) {
+		// the CRC was computed while receiving, no need to read the file again
+		if (ble_file_crc == crc_value) {
+			jo["result"] = "ok";		
+			fileMetaPut((char*)&ble_file_name[0], ble_file_size, crc_value, NULL);
+		} else {
+			jo["result"] = "failed crc";
+			BleStats_add(BLE_STAT_CRC_FAILURES);
 		}
-		break;
-		
-		case 140: // read filesystem
-		{
-			// Json object for outgoing data 
-			JsonObject& jo = jsonBuffer.createObject();
-			jo["read"] = "filesystem";
-			if (spiffs_mount) {
-				jo["result"] = "ok";
-				size_t totalBytes;
-				totalBytes = SPIFFS.totalBytes() * 0.80; // filesystem use at least 20% of partition
-				jo["totalBytes"] = totalBytes;
-				size_t usedBytes; // it means entire size of all files
-				listDirSize(SPIFFS, "/", NULL, &usedBytes); 
-				jo["usedBytes"] = usedBytes;
+	} else {
+		jo["result"] = "failed write file";
+	} 
+	// the client waits for the result, a timeout or an overflow ends as "failed write file"
+	BleSerial_sendJson(jo);
+	jsonBuffer.clear();
+	request->continuation = NULL;
+}
+
+/** Data bytes of one chunk, the frame must fit into the receive buffer */
+const size_t ble_upload_chunk_size = 512;
+/** Data bytes the client may send beyond the last ack */
+const size_t ble_upload_window = 2048;
+/** Ack after this many new data bytes */
+const size_t ble_upload_ack_interval = 1024;
+
+/**
+ * BleUpload
+ * State of a chunked upload. Kept after a stall or a disconnect,
+ * so the client can resume from offset instead of starting over.
+ */
+typedef struct BleUpload {
+	bool used;
+	char name[33];
+	char partName[33]; // data is written here until the whole file is verified
+	size_t size;
+	uint32_t crc;
+	size_t offset; // verified bytes in the part file
+	size_t acked;
+	bool nacked; // a nack for offset was sent already
+	uint32_t deadline; // millis() when the upload stalls
+	Crc32 fileCrc; // CRC of the verified bytes, updated chunk by chunk
+	File file;
+} BleUpload;
+
+BleUpload ble_upload;
+
+static uint32_t readLittleEndian32(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/** Ack or nack of a chunked upload, the client continues at offset */
+void sendUploadAck(const char *key, size_t offset)
+{
+	StaticJsonBuffer<96> ackBuffer;
+	JsonObject& jo = ackBuffer.createObject();
+	jo["write"] = "file";
+	jo[key] = offset;
+	BleSerial_sendJson(jo);
+}
+
+void finishChunkedUpload(BleRequest *request, const char *result)
+{
+	ble_upload.file.close();
+	if (strcmp(result, "ok") == 0) {
+		uint32_t crc_value = ble_upload.fileCrc.finalize();
+		fileMetaRemove(ble_upload.name);
+		if (crc_value != ble_upload.crc) {
+			result = "failed crc";
+			BleStats_add(BLE_STAT_CRC_FAILURES);
+		} else {
+			if (SPIFFS.remove(ble_upload.name))
+				ble_dir_index.remove(ble_upload.name);
+			if (SPIFFS.rename(ble_upload.partName, ble_upload.name) == false) {
+				result = "failed write file";
 			} else {
-				jo["result"] = "failed not mount";
+				ble_dir_index.rename(ble_upload.partName, ble_upload.name);
+				fileMetaPut(ble_upload.name, ble_upload.size, crc_value, NULL);
 			}
+		}
+		// a complete upload that failed cannot be resumed
+		if (SPIFFS.remove(ble_upload.partName))
+			ble_dir_index.remove(ble_upload.partName);
+		ble_upload.used = false;
+	}
 
-			ble_read_string = "";
-			ble_write_string = ""; jo.printTo(ble_write_string);
-			jsonBuffer.clear();
-			ble_write_count = ble_write_string.length();
-			Serial.print("ws ");
-			Serial.println(ble_write_string);			
-			memcpy(ble_write_buffer, (void*)&ble_write_string[0], ble_write_string.length());
-			BleSerial_encode(ble_write_buffer, ble_write_count);
-			BleSerial_write(ble_write_buffer, ble_write_count);
-			ble_state = 100;
+	StaticJsonBuffer<128> resultBuffer;
+	JsonObject& jo = resultBuffer.createObject();
+	jo["write"] = "file";
+	jo["result"] = result;
+	jo["offset"] = ble_upload.offset;
+	BleSerial_sendJson(jo);
+	ble_frame_decoder.reset();
+	request->continuation = NULL;
+}
+
+/**
+ * Receive BLE_FRAME_FILE_CHUNK frames. A chunk is written only if it starts
+ * at the expected offset and its CRC matches, otherwise the client is told
+ * where to continue. Any other frame ends the upload with an error reply.
+ * Only complete frames are taken out of the receive buffer.
+ */
+void continueChunkedUpload(BleRequest *request)
+{
+	size_t needed = 1; // bytes to wait for before the next step can be taken
+	while (ble_upload.offset < ble_upload.size) {
+		if (ble_frame_decoder.hasHeader() == false) {
+			needed = 1;
+			if (BleSerial_available() == 0)
+				break;
+			size_t count = BleSerial_readBytes(ble_frame_decoder.next(), ble_frame_decoder.wanted());
+			if (ble_frame_decoder.commit(count) == false)
+				continue;
+		}
+		const BleFrameHeader &header = ble_frame_decoder.getHeader();
+		if (header.length > BUFFER_SIZE || header.length > BleSerial_capacity()) {
+			finishChunkedUpload(request, "failed chunk too large");
+			return;
+		}
+		needed = header.length;
+		if ((size_t)BleSerial_available() < header.length)
 			break;
+		BleSerial_readBytes(ble_read_buffer, header.length);
+		ble_frame_decoder.reset();
+		BleStats_add(BLE_STAT_FRAMES);
+		ble_upload.deadline = millis() + ble_file_timeout_ms;
+		if (header.type != BLE_FRAME_FILE_CHUNK || header.length < BLE_FRAME_CHUNK_HEADER_SIZE) {
+			// a request or a broken frame in the middle of the upload, the part file is kept for a resume
+			finishChunkedUpload(request, header.type != BLE_FRAME_FILE_CHUNK ? "failed unexpected frame" : "failed chunk invalid");
+			return;
 		}
-		break;
-				
-		case 150: // read listDir
-		{
-			// Json object for outgoing data 
-			JsonObject& jo = jsonBuffer.createObject();
-			jo["read"] = "listDir";
-			if (spiffs_mount) {
-				jo["result"] = "ok";
-				JsonArray& jaFileName = jo.createNestedArray("listDirFileName");
-				JsonArray& jaFileSize = jo.createNestedArray("listDirFileSize");
-				listDirToJson(SPIFFS, "/", 0, jaFileName, jaFileSize);
-			} else {
-				jo["result"] = "failed not mount";
-			}
 
-			ble_read_string = "";
-			ble_write_string = ""; jo.printTo(ble_write_string);
-			jsonBuffer.clear();
-			ble_write_count = ble_write_string.length();
-			Serial.print("ws ");
-			Serial.println(ble_write_string);			
-			memcpy(ble_write_buffer, (void*)&ble_write_string[0], ble_write_string.length());
-			BleSerial_encode(ble_write_buffer, ble_write_count);
-			BleSerial_write(ble_write_buffer, ble_write_count);
-			ble_state = 100;
-			break;
+		size_t offset = readLittleEndian32(&ble_read_buffer[0]);
+		uint32_t chunkCrc = readLittleEndian32(&ble_read_buffer[4]);
+		uint8_t *data = &ble_read_buffer[BLE_FRAME_CHUNK_HEADER_SIZE];
+		size_t length = header.length - BLE_FRAME_CHUNK_HEADER_SIZE;
+		if (offset < ble_upload.offset) {
+			// repeated chunk, already written
+			continue;
 		}
-		break;
-				
-		case 160: // read file
-		{
-			jsonBuffer.clear();
-
-			JsonObject& joRead = jsonBuffer.parseObject(ble_read_string);
-			if (joRead.success() == false) {
-				ble_state = 100;
-				break;
+		if (offset != ble_upload.offset || length > ble_upload.size - offset ||
+			Crc32::calculate(data, length) != chunkCrc) {
+			// lost or damaged chunk, everything after it is resent anyway
+			if (offset == ble_upload.offset && length <= ble_upload.size - offset)
+				BleStats_add(BLE_STAT_CRC_FAILURES);
+			if (ble_upload.nacked == false) {
+				sendUploadAck("nack", ble_upload.offset);
+				ble_upload.nacked = true;
 			}
+			continue;
+		}
+		if (ble_upload.file.write(data, length) != length) {
+			finishChunkedUpload(request, "failed write file");
+			return;
+		}
+		ble_upload.fileCrc.update(data, length);
+		ble_upload.offset += length;
+		ble_dir_index.set(ble_upload.partName, ble_upload.offset);
+		ble_upload.nacked = false;
+		if (ble_upload.offset - ble_upload.acked >= ble_upload_ack_interval && ble_upload.offset < ble_upload.size) {
+			ble_upload.acked = ble_upload.offset;
+			sendUploadAck("ack", ble_upload.offset);
+		}
+		esp_task_wdt_reset();
+	}
+
+	if (ble_upload.offset >= ble_upload.size) {
+		finishChunkedUpload(request, "ok");
+		return;
+	}
+	// sleep until the rest of the frame is in, called again right after
+	if (BleSerial_waitAvailable(needed, timeLeft(ble_upload.deadline)) == false) {
+		// keep the part file, the client may resume later
+		finishChunkedUpload(request, "failed timeout");
+	}
+}
 
-			JsonObject& joWrite = jsonBuffer.createObject();
-			joWrite["read"] = "file";
-			ble_file_name = "";
-			if (spiffs_mount) {
-				if (joRead.containsKey("fileName")) {
-					ble_file_name = joRead["fileName"].as<String>();
-					if (getFileSize(SPIFFS, (char*)&ble_file_name[0], &ble_file_size) && 
-						getFileCRC(SPIFFS, (char*)&ble_file_name[0], &ble_file_crc)) {
-						joWrite["result"] = "ok";
-						joWrite["fileSize"] = ble_file_size;
-						joWrite["fileCRC"] = ble_file_crc;
+/**
+ * Prepare a chunked upload, returns the offset to continue from
+ * or -1 if the part file cannot be opened
+ */
+long startChunkedUpload(BleRequest *request)
+{
+	bool resume = request->resume && ble_upload.used &&
+		strcmp(ble_upload.name, request->fileName) == 0 &&
+		ble_upload.size == request->fileSize &&
+		ble_upload.crc == request->fileCRC;
+	if (resume) {
+		size_t partSize = 0;
+		resume = getFileSize(SPIFFS, ble_upload.partName, &partSize) && partSize == ble_upload.offset;
+	}
+	if (resume == false) {
+		if (ble_upload.used && SPIFFS.remove(ble_upload.partName))
+			ble_dir_index.remove(ble_upload.partName);
+		ble_upload.used = true;
+		strcpy(ble_upload.name, request->fileName);
+		snprintf(ble_upload.partName, sizeof(ble_upload.partName), "%s~", request->fileName);
+		ble_upload.size = request->fileSize;
+		ble_upload.crc = request->fileCRC;
+		ble_upload.offset = 0;
+		ble_upload.fileCrc.reset();
+	}
+	ble_upload.acked = ble_upload.offset;
+	ble_upload.nacked = false;
+	ble_upload.deadline = millis() + ble_file_timeout_ms;
+	ble_upload.file = SPIFFS.open(ble_upload.partName, resume ? FILE_APPEND : FILE_WRITE);
+	if (!ble_upload.file) {
+		ble_upload.used = false;
+		return -1;
+	}
+	ble_dir_index.set(ble_upload.partName, ble_upload.offset);
+	return ble_upload.offset;
+}
+
+void handleWriteFile(BleRequest *request)
+{
+	jsonBuffer.clear();
+	JsonObject& joWrite = jsonBuffer.createObject();
+	joWrite["write"] = "file";
+	ble_file_name = "";
+	ble_file_size = 0;
+	ble_file_crc = 0;
+	ble_file_compressed_size = 0;
+	if (spiffs_mount) {
+		if (request->hasFileName &&
+			request->hasFileSize &&
+			request->hasFileCRC ) {
+			ble_file_name = request->fileName;
+			ble_file_size = request->fileSize;
+			ble_file_crc = request->fileCRC;
+			size_t totalBytes;
+			totalBytes = SPIFFS.totalBytes() * 0.80; // // filesystem use at least 20% of partition
+			size_t usedBytes; // it means entire size of all files
+			listDirSize(SPIFFS, "/", 
+				&ble_file_name[1], // without '/'
+				&usedBytes); // 
+			if (request->chunked && (request->framed == false || strlen(request->fileName) + 1 >= sizeof(ble_upload.partName))) {
+				// chunks need framing, and the part file name needs one more character
+				joWrite["result"] = "failed argument invalid";
+			} else if (totalBytes - usedBytes >= ble_file_size) {
+				joWrite["result"] = "ok";
+				if (request->chunked) {
+					long offset = startChunkedUpload(request);
+					if (offset < 0) {
+						joWrite["result"] = "failed write file";
 					} else {
-						joWrite["result"] = "failed file not exist";
+						joWrite["offset"] = offset;
+						joWrite["chunkSize"] = ble_upload_chunk_size;
+						joWrite["window"] = ble_upload_window;
 					}
 				} else {
-					joWrite["result"] = "failed argument invalid";
+					// the client must not send more than this before the next credit
+					joWrite["credit"] = BleSerial_free();
+					// credits count bytes of the LZSS stream, fileSize and fileCRC those of the file
+					if (request->compressed && request->hasCompressedSize && request->compressedSize > 0)
+						ble_file_compressed_size = request->compressedSize;
 				}
+				if (request->hasCompression)
+					joWrite["compression"] = ble_file_compressed_size > 0 ? "lzss" : "none";
 			} else {
-				joWrite["result"] = "failed not mount";
+				BLE_LOGW("file", "%u-%u>%u", totalBytes, usedBytes, ble_file_size);
+				joWrite["result"] = "failed too large size";
 			}
-
-			ble_read_string = "";
-			ble_write_string = ""; joWrite.printTo(ble_write_string);
-			jsonBuffer.clear();
-			ble_write_count = ble_write_string.length();
-			Serial.print("ws ");
-			Serial.println(ble_write_string);			
-			memcpy(ble_write_buffer, (void*)&ble_write_string[0], ble_write_string.length());
-			BleSerial_encode(ble_write_buffer, ble_write_count);
-			BleSerial_write(ble_write_buffer, ble_write_count);
-			if (joWrite["result"] != "ok") {
-				ble_state = 100;
-				break;
-			}
-			ble_state_timer100ms = 1; // give time android to get ready
-			ble_state++;
-			break;
+		} else {
+			joWrite["result"] = "failed argument invalid";
 		}
-		break;
-				
-		case 161:
-		{
-			if (ble_state_timer100ms != 0)
-				break;
+	} else {
+		joWrite["result"] = "failed not mount";
+	}
+	BleSerial_sendJson(joWrite);
+	jsonBuffer.clear();
+	if (joWrite["result"] != "ok") {
+		return;
+	}
+	request->continuation = request->chunked ? continueChunkedUpload : continueWriteFile;
+}
 
-			if (readFile(SPIFFS, (char*)&ble_file_name[0]) == false)
-			{
-				ble_state = 100;
-				break;
-			}
-			ble_state = 100;
-			break;
-		}
-		break;
+void handleErase(BleRequest *request)
+{
+	int err;
+	err = nvs_flash_init();
+	Serial.print("nvs_flash_init: ");
+	Serial.println(err);
+	err = nvs_flash_erase();
+	Serial.print("nvs_flash_erase: ");
+	Serial.println(err);
+
+	loadConfigs();
+	jsonBuffer.clear();
+
+	// Json object for outgoing data 
+	JsonObject& jo = jsonBuffer.createObject();
+	jo["erase"] = "";
+
+	BleSerial_sendJson(jo);
+	jsonBuffer.clear();
+}
 
-		case 230: // write value
-		{
-			jsonBuffer.clear();
+/** Encodings of requests, a client that finds msgpack may send BLE_FRAME_MSGPACK frames */
+void handleReadEncodings(BleRequest *request)
+{
+	JsonObject& jo = jsonBuffer.createObject();
+	jo["read"] = "encodings";
+	JsonArray& ja = jo.createNestedArray("encodings");
+	ja.add("json");
+	ja.add("msgpack");
+
+	BleSerial_sendJson(jo);
+	jsonBuffer.clear();
+}
 
-			JsonObject& jo = jsonBuffer.parseObject(ble_read_string);
-			if (jo.success() == false) {
-				ble_state = 100;
-				break;
-			}
+/** Room the stats reply takes, larger than jsonBuffer with about a hundred values */
+#define BLE_STATS_JSON_SIZE (JSON_OBJECT_SIZE(8) + JSON_OBJECT_SIZE(BLE_STAT_COUNTER_COUNT + 1) + \
+	JSON_ARRAY_SIZE(BLE_STAT_BUCKET_COUNT - 1) + JSON_OBJECT_SIZE(BLE_STAT_HISTOGRAM_COUNT) + \
+	BLE_STAT_HISTOGRAM_COUNT * JSON_ARRAY_SIZE(BLE_STAT_BUCKET_COUNT + 1))
 
-			JsonArray& ja = jo["value"];
-			Preferences p;
-			p.begin("configs", false);
-			for(int i = 0; i < rgc_array_count; i++) {
-				RGConfig* rgc = rgc_array[i];
-				rgc->FromJsonArrayValue(ja);				
-				rgc->Put(&p);
-			}
-			jsonBuffer.clear();
-			p.end();
-		}
-		{
-			// Json object for outgoing data 
-			JsonObject& jo = jsonBuffer.createObject();
-			jo["write"] = "value";
-
-			ble_read_string = "";
-			ble_write_string = ""; jo.printTo(ble_write_string);
-			jsonBuffer.clear();
-			ble_write_count = ble_write_string.length();
-			Serial.print("ws ");
-			Serial.println(ble_write_string);			
-			memcpy(ble_write_buffer, (void*)&ble_write_string[0], ble_write_string.length());
-			BleSerial_encode(ble_write_buffer, ble_write_count);
-			BleSerial_write(ble_write_buffer, ble_write_count);
-			ble_state = 100;
-			break;
+void handleReadStats(BleRequest *request)
+{
+	StaticJsonBuffer<BLE_STATS_JSON_SIZE> statsBuffer;
+	JsonObject& jo = statsBuffer.createObject();
+	jo["read"] = "stats";
+	jo["result"] = "ok";
+	jo["uptime"] = millis();
+	JsonObject& joCounters = jo.createNestedObject("counters");
+	for (int i = 0; i < BLE_STAT_COUNTER_COUNT; i++)
+		joCounters[BleStats_counterName((BleStatCounter)i)] = BleStats_get((BleStatCounter)i);
+	joCounters["logDropped"] = BleLog_dropped();
+	JsonArray& jaBounds = jo.createNestedArray("bucketsUs");
+	for (int i = 0; i < BLE_STAT_BUCKET_COUNT - 1; i++)
+		jaBounds.add(bleStatBucketBounds[i]);
+	// per histogram the bucket counts, then the largest value seen
+	JsonObject& joHistograms = jo.createNestedObject("histograms");
+	for (int i = 0; i < BLE_STAT_HISTOGRAM_COUNT; i++) {
+		JsonArray& ja = joHistograms.createNestedArray(BleStats_histogramName((BleStatHistogram)i));
+		for (int j = 0; j < BLE_STAT_BUCKET_COUNT; j++)
+			ja.add(bleStatHistograms[i].buckets[j].load());
+		ja.add(bleStatHistograms[i].max.load());
+	}
+	BleSerial_sendJson(jo);
+	if (request->clear)
+		BleStats_reset();
+}
+
+void handleReset(BleRequest *request)
+{
+	ESP.restart();
+}
+
+/** Commands understood by ReadBLESerialTask */
+void registerCommands()
+{
+	BleCommand_register(BLE_COMMAND("read", "config_count"), handleReadConfigCount, BLE_HIST_HANDLER_CONFIG_READ);
+	BleCommand_register(BLE_COMMAND("read", "config_index"), handleReadConfigIndex, BLE_HIST_HANDLER_CONFIG_READ);
+	BleCommand_register(BLE_COMMAND("read", "configs"), handleReadConfigs, BLE_HIST_HANDLER_CONFIG_READ);
+	BleCommand_register(BLE_COMMAND("read", "value"), handleReadValue, BLE_HIST_HANDLER_CONFIG_READ);
+	BleCommand_register(BLE_COMMAND("read", "filesystem"), handleReadFilesystem, BLE_HIST_HANDLER_FILE_READ);
+	BleCommand_register(BLE_COMMAND("read", "listDir"), handleReadListDir, BLE_HIST_HANDLER_FILE_READ);
+	BleCommand_register(BLE_COMMAND("read", "file"), handleReadFile, BLE_HIST_HANDLER_FILE_READ);
+	BleCommand_register(BLE_COMMAND("read", "stats"), handleReadStats);
+	BleCommand_register(BLE_COMMAND("read", "encodings"), handleReadEncodings);
+	BleCommand_register(BLE_COMMAND("write", "value"), handleWriteValue, BLE_HIST_HANDLER_CONFIG_WRITE);
+	BleCommand_register(BLE_COMMAND("write", "file"), handleWriteFile, BLE_HIST_HANDLER_FILE_WRITE);
+	BleCommand_register(BLE_COMMAND("erase", ""), handleErase, BLE_HIST_HANDLER_CONFIG_WRITE);
+	BleCommand_register(BLE_COMMAND("reset", ""), handleReset);
+}
+
+/** File transfers use the ble_file_* and ble_upload state, one at a time */
+bool BleRequest_isFileTransfer(BleRequest *request)
+{
+	return request->command == BLE_COMMAND("read", "file") || request->command == BLE_COMMAND("write", "file");
+}
+
+/** The bytes that follow an upload request on the receive stream belong to it */
+bool BleRequest_ownsReceive(BleRequest *request)
+{
+	return request->command == BLE_COMMAND("write", "file");
+}
+
+/**
+ * The bytes that follow a download reply on the transmit stream belong to it,
+ * they are raw file content, so no other reply may go out until it is done
+ */
+bool BleRequest_ownsTransmit(BleRequest *request)
+{
+	return request->command == BLE_COMMAND("read", "file");
+}
+
+/**
+ * Read the next request from the receive buffer into request.
+ * Returns false if none was completed, e.g. only part of a frame header arrived.
+ */
+bool BleRequest_receive(BleRequest *request)
+{
+	BleRequestReader reader;
+	bool start = false;
+	if (ble_frame_decoder.isIdle() && BleSerial_peek() != BLE_FRAME_MAGIC) {
+		// unframed client, the request ends with its closing brace
+		reader.framed = false;
+		reader.remaining = 0;
+		start = true;
+	} else {
+		while (start == false && BleSerial_available()) {
+			size_t count = BleSerial_readBytes(ble_frame_decoder.next(), ble_frame_decoder.wanted());
+			start = ble_frame_decoder.commit(count);
 		}
-		break;
-								
-		case 260: // write file
-		{
-			jsonBuffer.clear();
-			Serial.println("1");
-			JsonObject& joRead = jsonBuffer.parseObject(ble_read_string);
-			if (joRead.success() == false) {
-				Serial.println("json parse failed");
-				ble_state = 100;
-				break;
-			}
+		reader.framed = true;
+		reader.remaining = ble_frame_decoder.getHeader().length;
+	}
+	if (start == false)
+		return false;
 
-			Serial.println("2");
-			JsonObject& joWrite = jsonBuffer.createObject();
-			joWrite["write"] = "file";
-			ble_file_name = "";
-			ble_file_size = 0;
-			ble_file_crc = 0;
-			if (spiffs_mount) {
-				if (joRead.containsKey("fileName") &&
-					joRead.containsKey("fileSize") &&
-					joRead.containsKey("fileCRC") ) {
-					ble_file_name = joRead["fileName"].as<String>();
-					ble_file_size = joRead["fileSize"].as<size_t>();
-					ble_file_crc = joRead["fileCRC"].as<uint32_t>();
-					size_t totalBytes;
-					totalBytes = SPIFFS.totalBytes() * 0.80; // // filesystem use at least 20% of partition
-					size_t usedBytes; // it means entire size of all files
-					listDirSize(SPIFFS, "/", 
-						&ble_file_name[1], // without '/'
-						&usedBytes); // 
-					if (totalBytes - usedBytes >= ble_file_size) {
-						joWrite["result"] = "ok";
-					} else {
-						Serial.print(totalBytes);
-						Serial.print("-");
-						Serial.print(usedBytes);
-						Serial.print(">");
-						Serial.println(ble_file_size);
-						joWrite["result"] = "failed too large size";
-					}
-				} else {
-					joWrite["result"] = "failed argument invalid";
-				}
-			} else {
-				joWrite["result"] = "failed not mount";
+	unsigned long parseStart = micros();
+	ble_rx_codec.reset();
+	reader.deadline = millis() + ble_file_timeout_ms;
+	reader.blockLength = 0;
+	reader.blockPosition = 0;
+	uint8_t sequence = ble_frame_decoder.getHeader().sequence;
+
+	bool parsed = false;
+	request->valuesApplied = false;
+	bool msgpack = reader.framed && ble_frame_decoder.getHeader().type == BLE_FRAME_MSGPACK;
+	if (reader.framed == false || ble_frame_decoder.getHeader().type == BLE_FRAME_JSON) {
+		JsonPull json(BleRequestReader_read, &reader, ble_json_text, sizeof(ble_json_text));
+		parsed = BleRequest_parse(json, request);
+	} else if (msgpack) {
+		MsgPackPull json(BleRequestReader_read, &reader, ble_json_text, sizeof(ble_json_text));
+		parsed = BleRequest_parse(json, request);
+	}
+	// drop whatever is left of the frame
+	while (reader.framed && reader.remaining > 0 && BleRequestReader_read(&reader) >= 0);
+	ble_frame_decoder.reset();
+	BLE_LOGD("ble", "Received over BLESerial: command %08x parsed %d", request->command, parsed);
+	BleStats_record(BLE_HIST_PARSE, micros() - parseStart);
+	BleStats_add(parsed ? BLE_STAT_REQUESTS : BLE_STAT_PARSE_ERRORS);
+	if (reader.framed)
+		BleStats_add(BLE_STAT_FRAMES);
+
+	if (request->valuesApplied && (parsed == false || request->command != BLE_COMMAND("write", "value"))) {
+		// values of a request that is not a complete write value
+		loadConfigs();
+	}
+	request->framed = reader.framed;
+	request->msgpack = msgpack;
+	request->sequence = sequence;
+	request->continuation = NULL;
+	request->wakeAt = 0;
+	return parsed;
+}
+
+// Task for reading BLE Serial
+void ReadBLESerialTask(void *e)
+{
+    while (true)
+    {
+		BleRequest *queued = NULL; // oldest queued request
+		BleRequest *due = NULL; // oldest running request whose continuation is due
+		bool running = false;
+		uint32_t wait = BLESERIAL_WAIT_FOREVER; // until the next continuation is due
+		BleRequest *idle = NULL;
+		bool receiveOwned = false;
+		bool transmitOwned = false;
+		for (int i = 0; i < BLE_REQUEST_SLOTS; i++) {
+			BleRequest *request = &ble_requests[i];
+			if (request->state == BLE_REQUEST_FREE) {
+				idle = request;
+				continue;
 			}
-			Serial.println("3");
-			ble_read_string = "";
-			ble_write_string = ""; joWrite.printTo(ble_write_string);
-			jsonBuffer.clear();
-			ble_write_count = ble_write_string.length();
-			Serial.print("ws ");
-			Serial.println(ble_write_string);			
-			memcpy(ble_write_buffer, (void*)&ble_write_string[0], ble_write_string.length());
-			BleSerial_encode(ble_write_buffer, ble_write_count);
-			BleSerial_write(ble_write_buffer, ble_write_count);
-			if (joWrite["result"] != "ok") {
-				ble_state = 100;
-				break;
+			if (request->state == BLE_REQUEST_RUNNING) {
+				running = true;
+				uint32_t left = timeLeft(request->wakeAt);
+				if (left == 0 && (due == NULL || request->order < due->order))
+					due = request;
+				else if (left > 0 && left < wait)
+					wait = left;
+				if (BleRequest_ownsTransmit(request))
+					transmitOwned = true;
+			} else if (queued == NULL || request->order < queued->order) {
+				queued = request;
 			}
-			ble_state_timer100ms = 0; 
-			ble_state++;
-			break;
+			if (BleRequest_ownsReceive(request))
+				receiveOwned = true;
 		}
-		break;
-				
-		case 261:
-		{
-			// Json object for outgoing data 
-			JsonObject& jo = jsonBuffer.createObject();
-			jo["write"] = "file";
-
-			if (writeFile(SPIFFS, (char*)&ble_file_name[0], ble_file_size)) {
-				uint32_t crc_value = 0;
-				if (getFileCRC(SPIFFS, (char*)&ble_file_name[0], &crc_value)) {
-					if (ble_file_crc == crc_value) {
-						jo["result"] = "ok";		
-					} else {
-						jo["result"] = "failed crc";
-					}
-				} else {
-					jo["result"] = "failed get file crc";
-				}
-			} else {
-				jo["result"] = "failed write file";
-			} 
-			// cannot know if ble_file_size == 0 because of error during file transferring
-			/*
-			ble_read_string = "";
-			ble_write_string = ""; jo.printTo(ble_write_string);
-			jsonBuffer.clear();
-			ble_write_count = ble_write_string.length();
-			Serial.print("ws ");
-			Serial.println(ble_write_string);			
-			memcpy(ble_write_buffer, (void*)&ble_write_string[0], ble_write_string.length());
-			BleSerial_encode(ble_write_buffer, ble_write_count);
-			BleSerial_write(ble_write_buffer, ble_write_count);
-			ble_state_timer100ms = 0; 
-			*/
-			ble_state = 100;
-			break;
+
+		// a continuation that is due, an upload is always due and waits on its own
+		if (due != NULL) {
+			ble_reply_request = due;
+			unsigned long start = micros();
+			due->continuation(due);
+			BleStats_record(BLE_HIST_CONTINUATION, micros() - start);
+			if (due->continuation == NULL)
+				due->state = BLE_REQUEST_FREE;
+			continue;
 		}
-		break;
-
-		case 300: // erase
-		{
-			int err;
-			err = nvs_flash_init();
-			Serial.print("nvs_flash_init: ");
-			Serial.println(err);
-			err = nvs_flash_erase();
-			Serial.print("nvs_flash_erase: ");
-			Serial.println(err);
-
-			Preferences p;
-			p.begin("configs", false);
-			for(int i = 0; i < rgc_array_count; i++) {
-				RGConfig* rgc = rgc_array[i];
-				rgc->Get(&p);
+
+		// the oldest queued request, a file transfer waits for the running one
+		// and every request waits for a download to finish its content
+		if (queued != NULL && transmitOwned == false && (running == false || BleRequest_isFileTransfer(queued) == false)) {
+			BleStatHistogram histogram;
+			BleCommandHandler handler = BleCommand_find(queued->command, &histogram);
+			queued->state = BLE_REQUEST_FREE;
+			if (handler != NULL) {
+				ble_reply_request = queued;
+				unsigned long start = micros();
+				handler(queued);
+				BleStats_record(histogram, micros() - start);
+				if (queued->continuation != NULL)
+					queued->state = BLE_REQUEST_RUNNING;
 			}
-			jsonBuffer.clear();
-			p.end();
-
-			// Json object for outgoing data 
-			JsonObject& jo = jsonBuffer.createObject();
-			jo["erase"] = "";
-
-			ble_read_string = "";
-			ble_write_string = ""; jo.printTo(ble_write_string);
-			jsonBuffer.clear();
-			ble_write_count = ble_write_string.length();
-			Serial.print("ws ");
-			Serial.println(ble_write_string);			
-			memcpy(ble_write_buffer, (void*)&ble_write_string[0], ble_write_string.length());
-			BleSerial_encode(ble_write_buffer, ble_write_count);
-			BleSerial_write(ble_write_buffer, ble_write_count);
-			ble_state = 100;
-			break;
-		}
-		
-		case 310: // reset
-		{			
-			ESP.restart();
-			break;
+			continue;
 		}
 
+		// parse ahead only behind requests that already ran, a later
+		// write value must not change the configurations a queued read sees
+		bool canReceive = queued == NULL && receiveOwned == false && idle != NULL;
+		if (canReceive && BleSerial_available()) {
+			if (BleRequest_receive(idle)) {
+				idle->state = BLE_REQUEST_QUEUED;
+				idle->order = ble_request_order++;
+			}
+			continue;
 		}
-        delay(10);
+
+		// sleep until onWrite brings a request or the earliest continuation is due
+		if (canReceive)
+			BleSerial_waitAvailable(1, wait);
+		else
+			vTaskDelay(wait == BLESERIAL_WAIT_FOREVER ? portMAX_DELAY : pdMS_TO_TICKS(wait));
     }
 }
 
 void setup() {
 	// Initialize Serial port
 	Serial.begin(115200);
+	BleLog_init();
 	
 	// Send some device info
 	Serial.print("Build: ");
 	Serial.println(compileDate);
 
-	Preferences p;
-	p.begin("configs", false);
-	for(int i = 0; i < rgc_array_count; i++) {
-		RGConfig* rgc = rgc_array[i];
-		rgc->Get(&p);
-	}
-	p.end();
+	loadConfigs();
 
-	RGConfigString* rgcs;
 	int defaultCount = 0;
-	for(int i = 5; i < 9; i++) {
-		rgcs = (RGConfigString*)rgc_array[i];
-		if (strcmp(rgcs->value, "") == 0) {
+	for(int i = RGC_SSID_PRIM; i <= RGC_PW_SEC; i++) {
+		if (strcmp(RGConfig_textAt(i), "") == 0) {
 			defaultCount++;
 		}
 	}
@@ -1190,35 +2184,17 @@ void setup() {
 	} else {
 		Serial.println("Read from preferences:");
 		hasCredentials = true;
-		for(int i = 5; i < 9; i++) {
-			rgcs = (RGConfigString*)rgc_array[i];
-			Serial.print(rgcs->name);
+		for(int i = RGC_SSID_PRIM; i <= RGC_PW_SEC; i++) {
+			Serial.print(rgc_desc[i].name);
 			Serial.print(" ");
-			Serial.println(rgcs->value);
+			Serial.println(RGConfig_textAt(i));
 		}
 	}
 
-	/*	
-	// for debug
-	for(int i = 0; i < 4; i++)
-	{
-		RGConfigInteger *rgci = (RGConfigInteger *)(rgc_array[i]);
-		Serial.print("v ");
-		Serial.print((uint32_t)(&rgci->value), HEX);
-		Serial.println(rgci->value);
-	}
-	
-	for(int i = 4; i < 9; i++)
-	{
-		RGConfigString *rgcs = (RGConfigString *)(rgc_array[i]);
-		Serial.print("v ");
-		Serial.print((uint32_t)(&rgcs->value), HEX);
-		Serial.println(rgcs->value);
-	}
-	*/
-
 	// Start BLE server
 	initBLE();
+	ble_rx_codec.setKey(apName);
+	ble_tx_codec.setKey(apName);
 
 	if (hasCredentials) {
 		// Check for available AP's
@@ -1236,8 +2212,11 @@ void setup() {
         return;
     }
 	spiffs_mount = true;
+	buildDirIndex(SPIFFS);
+	fileMetaMount(SPIFFS);
 
     // Start tasks
+	registerCommands();
     xTaskCreate(ReadBLESerialTask, "ReadBLESerialTask", 10240, NULL, 1, NULL);
 }
 